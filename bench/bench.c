@@ -0,0 +1,236 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <json-c/json.h>
+#include "bench.h"
+#include "cbor.h"
+#include "commands.h"
+#include "config.h"
+#include "container.h"
+#include "criteria.h"
+#include "handlers.h"
+#include "extensions.h"
+#include "input.h"
+#include "input_state.h"
+#include "ipc-server.h"
+#include "layout.h"
+#include "list.h"
+#include "log.h"
+
+/*
+ * Times sway's hot paths on a made up session: outputs, workspaces and views
+ * are created through the wlc callbacks, with bench/wlc.c standing in for the
+ * compositor. Each benchmark runs until it took BENCH_TIME_NS and prints the
+ * average time of one run.
+ */
+
+#define BENCH_TIME_NS 200000000u
+#define BENCH_OUTPUTS 4
+#define BENCH_WORKSPACES 10 // per output
+#define BENCH_VIEWS 8 // per workspace
+#define BENCH_RULES 150
+
+void sway_terminate(void) {
+	exit(EXIT_FAILURE);
+}
+
+// Results go here, so the compiler can't drop the work that made them.
+static volatile uintptr_t sink;
+
+static wlc_handle view_handles[BENCH_MAX_VIEWS];
+static swayc_t *view_containers[BENCH_MAX_VIEWS];
+static int view_count = 0;
+
+// GET_TREE of the session, and the same as CBOR
+static char *tree_json = NULL;
+static uint32_t tree_json_length = 0;
+static struct cbor_buffer tree_cbor;
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// for_window rules that don't match any view, as most rules don't match a
+// given view. They're a mix of literal, anchored and regex values.
+static void bench_config(void) {
+	FILE *f = tmpfile();
+	if (!f) {
+		sway_abort("Unable to create the bench config");
+	}
+	int i;
+	for (i = 0; i < BENCH_RULES; ++i) {
+		switch (i % 3) {
+		case 0:
+			fprintf(f, "for_window [app_id=\"^rule%d$\"] floating enable\n", i);
+			break;
+		case 1:
+			fprintf(f, "for_window [title=\"^Rule %d\"] floating enable\n", i);
+			break;
+		case 2:
+			fprintf(f, "for_window [app_id=\"rule%d\"] floating enable\n", i);
+			break;
+		}
+	}
+	rewind(f);
+	if (!read_config(f, false)) {
+		sway_abort("Unable to read the bench config");
+	}
+	fclose(f);
+	config->active = true;
+}
+
+static void bench_session(void) {
+	int o, w, v;
+	int workspace = 0;
+	for (o = 0; o < BENCH_OUTPUTS; ++o) {
+		wlc_handle output = bench_output_add(2560, 1440);
+		interface.output.created(output);
+		interface.output.focus(output, true);
+		for (w = 0; w < BENCH_WORKSPACES; ++w) {
+			char command[32];
+			snprintf(command, sizeof(command), "workspace %d", ++workspace);
+			free_cmd_results(handle_command(command));
+			for (v = 0; v < BENCH_VIEWS && view_count < BENCH_MAX_VIEWS; ++v) {
+				char title[32], app_id[16];
+				snprintf(title, sizeof(title), "View %d - document", view_count);
+				snprintf(app_id, sizeof(app_id), "app%d", view_count % 20);
+				wlc_handle handle = bench_view_add(title, app_id);
+				interface.view.created(handle);
+				view_handles[view_count] = handle;
+				view_containers[view_count] = swayc_by_handle(handle);
+				++view_count;
+			}
+		}
+	}
+	const char *json = ipc_json_describe_tree(&root_container, &tree_json_length);
+	if (!json) {
+		sway_abort("Unable to describe the bench tree");
+	}
+	tree_json = strdup(json);
+	if (!cbor_from_json(&tree_cbor, tree_json, tree_json_length)) {
+		sway_abort("Unable to transcode the bench tree");
+	}
+}
+
+static void bench_run(const char *filter, const char *name, void (*run)(int i)) {
+	if (filter && !strstr(name, filter)) {
+		return;
+	}
+	int64_t iterations = 1, i;
+	uint64_t elapsed;
+	// double the runs until they take long enough to time
+	while (true) {
+		uint64_t start = now_ns();
+		for (i = 0; i < iterations; ++i) {
+			run((int)i);
+		}
+		elapsed = now_ns() - start;
+		if (elapsed >= BENCH_TIME_NS || iterations >= INT32_MAX) {
+			break;
+		}
+		iterations *= 2;
+	}
+	printf("%-28s %12.1f ns %12" PRId64 " runs\n", name, (double)elapsed / iterations, iterations);
+}
+
+static void run_lookup(int i) {
+	sink ^= (uintptr_t)swayc_by_handle(view_handles[i % view_count]);
+}
+
+static void run_lookup_missing(int i) {
+	sink ^= (uintptr_t)swayc_by_handle(BENCH_MAX_OUTPUTS + BENCH_MAX_VIEWS + 1 + i % 1024);
+}
+
+static void run_criteria_for(int i) {
+	list_t *criteria = criteria_for(view_containers[i % view_count]);
+	sink ^= criteria->length;
+	list_free(criteria);
+}
+
+static void run_command(int i) {
+	// commands that only set an option, so it's mostly the dispatch
+	static char *commands[] = {
+		"focus_follows_mouse yes",
+		"mouse_warping output",
+		"seamless_mouse no",
+		"workspace_auto_back_and_forth no",
+		"no_such_command",
+	};
+	struct cmd_results *results = handle_command(commands[i % (sizeof(commands) / sizeof(char *))]);
+	sink ^= results->status;
+	free_cmd_results(results);
+}
+
+static void run_command_criteria(int i) {
+	struct cmd_results *results = handle_command("[app_id=\"^app7$\"] mouse_warping output");
+	sink ^= results->status;
+	free_cmd_results(results);
+}
+
+static void run_get_tree(int i) {
+	uint32_t length;
+	sink ^= (uintptr_t)ipc_json_describe_tree(&root_container, &length);
+}
+
+static void run_json_c_serialize(int i) {
+	static json_object *tree = NULL;
+	if (!tree) {
+		tree = json_tokener_parse(tree_json);
+	}
+	sink ^= (uintptr_t)json_object_to_json_string(tree);
+}
+
+static void run_json_c_parse(int i) {
+	json_object *tree = json_tokener_parse(tree_json);
+	sink ^= (uintptr_t)tree;
+	json_object_put(tree);
+}
+
+static void run_cbor_transcode(int i) {
+	static struct cbor_buffer buffer;
+	cbor_from_json(&buffer, tree_json, tree_json_length);
+	sink ^= buffer.length;
+}
+
+static void run_cbor_read(int i) {
+	struct cbor_reader reader;
+	struct cbor_item item;
+	cbor_reader_init(&reader, tree_cbor.data, tree_cbor.length);
+	while (cbor_read(&reader, &item)) {
+		sink ^= item.type;
+	}
+}
+
+int main(int argc, char **argv) {
+	const char *filter = argc > 1 ? argv[1] : NULL;
+
+	init_log(L_ERROR);
+	input_devices = create_list();
+	register_extensions();
+	init_layout();
+	input_init();
+	bench_config();
+	ipc_init();
+	bench_session();
+
+	printf("%d outputs, %d workspaces, %d views, %d rules, GET_TREE %u bytes, as CBOR %zu\n",
+		BENCH_OUTPUTS, BENCH_OUTPUTS * BENCH_WORKSPACES, view_count, BENCH_RULES,
+		tree_json_length, tree_cbor.length);
+	bench_run(filter, "swayc_by_handle", run_lookup);
+	bench_run(filter, "swayc_by_handle missing", run_lookup_missing);
+	bench_run(filter, "criteria_for", run_criteria_for);
+	bench_run(filter, "command", run_command);
+	bench_run(filter, "command [criteria]", run_command_criteria);
+	bench_run(filter, "get_tree", run_get_tree);
+	bench_run(filter, "get_tree json-c", run_json_c_serialize);
+	bench_run(filter, "parse json-c", run_json_c_parse);
+	bench_run(filter, "parse cbor", run_cbor_read);
+	bench_run(filter, "transcode cbor", run_cbor_transcode);
+
+	ipc_terminate();
+	return 0;
+}
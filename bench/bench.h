@@ -0,0 +1,17 @@
+#ifndef _SWAY_BENCH_H
+#define _SWAY_BENCH_H
+
+#include <stdint.h>
+#include <wlc/wlc.h>
+
+#define BENCH_MAX_OUTPUTS 16
+#define BENCH_MAX_VIEWS 1024
+
+/**
+ * Makes up an output or view for the fake wlc, returns its handle or 0 if
+ * there's no room. The handle is then passed to sway's created callback.
+ */
+wlc_handle bench_output_add(uint32_t width, uint32_t height);
+wlc_handle bench_view_add(const char *title, const char *app_id);
+
+#endif
@@ -0,0 +1,248 @@
+#include <stdio.h>
+#include <string.h>
+#include <wayland-server.h>
+#include <wlc/wlc.h>
+#include <wlc/wlc-wayland.h>
+#include "bench.h"
+
+/*
+ * Stands in for libwlc, so sway's callbacks run without a compositor. Outputs
+ * and views only keep what sway reads back, everything else does nothing.
+ */
+
+struct fake_output {
+	char name[16];
+	struct wlc_size resolution;
+};
+
+struct fake_view {
+	char title[32];
+	char app_id[16];
+	wlc_handle output;
+	struct wlc_geometry geometry;
+	uint32_t state, mask;
+};
+
+static struct fake_output outputs[BENCH_MAX_OUTPUTS];
+static struct fake_view views[BENCH_MAX_VIEWS];
+static int output_count = 0, view_count = 0;
+static wlc_handle focused_output = 0;
+static struct wlc_point pointer = { 0, 0 };
+
+// Handles are 1 based, 0 is no output/view. Views come after the outputs,
+// as with wlc both share one handle space.
+static struct fake_output *fake_output(wlc_handle handle) {
+	if (handle < 1 || handle > (wlc_handle)output_count) {
+		return NULL;
+	}
+	return &outputs[handle - 1];
+}
+
+static struct fake_view *fake_view(wlc_handle handle) {
+	if (handle <= BENCH_MAX_OUTPUTS || handle > BENCH_MAX_OUTPUTS + (wlc_handle)view_count) {
+		return NULL;
+	}
+	return &views[handle - BENCH_MAX_OUTPUTS - 1];
+}
+
+wlc_handle bench_output_add(uint32_t width, uint32_t height) {
+	if (output_count == BENCH_MAX_OUTPUTS) {
+		return 0;
+	}
+	struct fake_output *output = &outputs[output_count++];
+	snprintf(output->name, sizeof(output->name), "BENCH-%d", output_count);
+	output->resolution = (struct wlc_size){ width, height };
+	return output_count;
+}
+
+wlc_handle bench_view_add(const char *title, const char *app_id) {
+	if (view_count == BENCH_MAX_VIEWS) {
+		return 0;
+	}
+	struct fake_view *view = &views[view_count++];
+	snprintf(view->title, sizeof(view->title), "%s", title);
+	snprintf(view->app_id, sizeof(view->app_id), "%s", app_id);
+	view->output = focused_output;
+	view->geometry = (struct wlc_geometry){ { 0, 0 }, { 640, 480 } };
+	return BENCH_MAX_OUTPUTS + view_count;
+}
+
+// Event loop
+
+static char event_source;
+
+struct wlc_event_source* wlc_event_loop_add_fd(int fd, uint32_t mask, int (*cb)(int fd, uint32_t mask, void *arg), void *arg) {
+	return (struct wlc_event_source *)&event_source;
+}
+
+struct wlc_event_source* wlc_event_loop_add_timer(int (*cb)(void *arg), void *arg) {
+	return (struct wlc_event_source *)&event_source;
+}
+
+bool wlc_event_source_timer_update(struct wlc_event_source *source, int32_t ms_delay) {
+	return true;
+}
+
+void wlc_event_source_remove(struct wlc_event_source *source) {
+}
+
+// Outputs
+
+wlc_handle wlc_get_focused_output(void) {
+	return focused_output;
+}
+
+const char* wlc_output_get_name(wlc_handle output) {
+	struct fake_output *o = fake_output(output);
+	return o ? o->name : NULL;
+}
+
+const struct wlc_size* wlc_output_get_resolution(wlc_handle output) {
+	struct fake_output *o = fake_output(output);
+	return o ? &o->resolution : NULL;
+}
+
+void wlc_output_set_resolution(wlc_handle output, const struct wlc_size *resolution) {
+	struct fake_output *o = fake_output(output);
+	if (o) {
+		o->resolution = *resolution;
+	}
+}
+
+void wlc_output_set_mask(wlc_handle output, uint32_t mask) {
+}
+
+void wlc_output_focus(wlc_handle output) {
+	focused_output = output;
+}
+
+void wlc_output_get_pixels(wlc_handle output, bool (*pixels)(const struct wlc_size *size, uint8_t *rgba, void *arg), void *arg) {
+}
+
+// Views
+
+void wlc_view_focus(wlc_handle view) {
+}
+
+void wlc_view_close(wlc_handle view) {
+}
+
+wlc_handle wlc_view_get_output(wlc_handle view) {
+	struct fake_view *v = fake_view(view);
+	return v ? v->output : 0;
+}
+
+void wlc_view_set_output(wlc_handle view, wlc_handle output) {
+	struct fake_view *v = fake_view(view);
+	if (v) {
+		v->output = output;
+	}
+}
+
+void wlc_view_send_to_back(wlc_handle view) {
+}
+
+void wlc_view_bring_to_front(wlc_handle view) {
+}
+
+uint32_t wlc_view_get_mask(wlc_handle view) {
+	struct fake_view *v = fake_view(view);
+	return v ? v->mask : 0;
+}
+
+void wlc_view_set_mask(wlc_handle view, uint32_t mask) {
+	struct fake_view *v = fake_view(view);
+	if (v) {
+		v->mask = mask;
+	}
+}
+
+const struct wlc_geometry* wlc_view_get_geometry(wlc_handle view) {
+	struct fake_view *v = fake_view(view);
+	return v ? &v->geometry : NULL;
+}
+
+void wlc_view_set_geometry(wlc_handle view, uint32_t edges, const struct wlc_geometry *geometry) {
+	struct fake_view *v = fake_view(view);
+	if (v) {
+		v->geometry = *geometry;
+	}
+}
+
+uint32_t wlc_view_get_type(wlc_handle view) {
+	return 0;
+}
+
+uint32_t wlc_view_get_state(wlc_handle view) {
+	struct fake_view *v = fake_view(view);
+	return v ? v->state : 0;
+}
+
+void wlc_view_set_state(wlc_handle view, enum wlc_view_state_bit state, bool toggle) {
+	struct fake_view *v = fake_view(view);
+	if (v) {
+		v->state = toggle ? v->state | state : v->state & ~state;
+	}
+}
+
+wlc_handle wlc_view_get_parent(wlc_handle view) {
+	return 0;
+}
+
+const char* wlc_view_get_title(wlc_handle view) {
+	struct fake_view *v = fake_view(view);
+	return v ? v->title : NULL;
+}
+
+const char* wlc_view_get_class(wlc_handle view) {
+	return NULL;
+}
+
+const char* wlc_view_get_app_id(wlc_handle view) {
+	struct fake_view *v = fake_view(view);
+	return v ? v->app_id : NULL;
+}
+
+// Input
+
+void wlc_pointer_get_position(struct wlc_point *out_position) {
+	*out_position = pointer;
+}
+
+void wlc_pointer_set_position(const struct wlc_point *position) {
+	pointer = *position;
+}
+
+uint32_t wlc_keyboard_get_keysym_for_key(uint32_t key, const struct wlc_modifiers *modifiers) {
+	return 0;
+}
+
+// Wayland, the extensions are registered on a display no client connects to
+
+struct wl_display* wlc_get_wl_display(void) {
+	static struct wl_display *display = NULL;
+	if (!display) {
+		display = wl_display_create();
+	}
+	return display;
+}
+
+wlc_handle wlc_handle_from_wl_surface_resource(struct wl_resource *resource) {
+	return 0;
+}
+
+wlc_handle wlc_handle_from_wl_output_resource(struct wl_resource *resource) {
+	return 0;
+}
+
+wlc_resource wlc_resource_from_wl_surface_resource(struct wl_resource *resource) {
+	return 0;
+}
+
+const struct wlc_size* wlc_surface_get_size(wlc_resource surface) {
+	static const struct wlc_size size = { 0, 0 };
+	return &size;
+}
+
+void wlc_surface_render(wlc_resource surface, const struct wlc_geometry *geometry) {
+}
@@ -0,0 +1,455 @@
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cbor.h"
+
+enum cbor_major {
+	CBOR_MAJOR_UINT = 0,
+	CBOR_MAJOR_NEGINT = 1,
+	CBOR_MAJOR_BYTES = 2,
+	CBOR_MAJOR_TEXT = 3,
+	CBOR_MAJOR_ARRAY = 4,
+	CBOR_MAJOR_MAP = 5,
+	CBOR_MAJOR_TAG = 6,
+	CBOR_MAJOR_SIMPLE = 7,
+};
+
+void cbor_buffer_finish(struct cbor_buffer *buffer) {
+	free(buffer->data);
+	buffer->data = NULL;
+	buffer->size = buffer->length = 0;
+}
+
+static bool cbor_reserve(struct cbor_buffer *buffer, size_t length) {
+	if (buffer->length + length <= buffer->size) {
+		return true;
+	}
+	size_t size = buffer->size ? buffer->size : 4096;
+	while (size < buffer->length + length) {
+		size *= 2;
+	}
+	uint8_t *data = realloc(buffer->data, size);
+	if (!data) {
+		return false;
+	}
+	buffer->data = data;
+	buffer->size = size;
+	return true;
+}
+
+static bool cbor_put(struct cbor_buffer *buffer, uint8_t byte) {
+	if (!cbor_reserve(buffer, 1)) {
+		return false;
+	}
+	buffer->data[buffer->length++] = byte;
+	return true;
+}
+
+// Writes the initial byte and the big endian argument that follows it, as
+// short as the value allows.
+static bool cbor_put_head(struct cbor_buffer *buffer, enum cbor_major major, uint64_t value) {
+	if (!cbor_reserve(buffer, 9)) {
+		return false;
+	}
+	uint8_t *p = buffer->data + buffer->length;
+	int bytes;
+	if (value < 24) {
+		*p = (major << 5) | value;
+		buffer->length += 1;
+		return true;
+	} else if (value <= UINT8_MAX) {
+		*p = (major << 5) | 24;
+		bytes = 1;
+	} else if (value <= UINT16_MAX) {
+		*p = (major << 5) | 25;
+		bytes = 2;
+	} else if (value <= UINT32_MAX) {
+		*p = (major << 5) | 26;
+		bytes = 4;
+	} else {
+		*p = (major << 5) | 27;
+		bytes = 8;
+	}
+	int i;
+	for (i = 0; i < bytes; ++i) {
+		p[bytes - i] = (value >> (8 * i)) & 0xff;
+	}
+	buffer->length += 1 + bytes;
+	return true;
+}
+
+static bool cbor_put_double(struct cbor_buffer *buffer, double number) {
+	uint64_t bits;
+	memcpy(&bits, &number, sizeof(bits));
+	if (!cbor_put(buffer, (CBOR_MAJOR_SIMPLE << 5) | 27) || !cbor_reserve(buffer, 8)) {
+		return false;
+	}
+	int i;
+	for (i = 0; i < 8; ++i) {
+		buffer->data[buffer->length++] = (bits >> (8 * (7 - i))) & 0xff;
+	}
+	return true;
+}
+
+static int hex_digit(char c) {
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	} else if (c >= 'a' && c <= 'f') {
+		return c - 'a' + 10;
+	} else if (c >= 'A' && c <= 'F') {
+		return c - 'A' + 10;
+	}
+	return -1;
+}
+
+static bool parse_hex4(const char *p, const char *end, uint32_t *value) {
+	if (end - p < 4) {
+		return false;
+	}
+	*value = 0;
+	int i;
+	for (i = 0; i < 4; ++i) {
+		int digit = hex_digit(p[i]);
+		if (digit == -1) {
+			return false;
+		}
+		*value = (*value << 4) | digit;
+	}
+	return true;
+}
+
+static size_t put_utf8(uint8_t *out, uint32_t c) {
+	if (c < 0x80) {
+		if (out) {
+			out[0] = c;
+		}
+		return 1;
+	} else if (c < 0x800) {
+		if (out) {
+			out[0] = 0xc0 | (c >> 6);
+			out[1] = 0x80 | (c & 0x3f);
+		}
+		return 2;
+	} else if (c < 0x10000) {
+		if (out) {
+			out[0] = 0xe0 | (c >> 12);
+			out[1] = 0x80 | ((c >> 6) & 0x3f);
+			out[2] = 0x80 | (c & 0x3f);
+		}
+		return 3;
+	}
+	if (out) {
+		out[0] = 0xf0 | (c >> 18);
+		out[1] = 0x80 | ((c >> 12) & 0x3f);
+		out[2] = 0x80 | ((c >> 6) & 0x3f);
+		out[3] = 0x80 | (c & 0x3f);
+	}
+	return 4;
+}
+
+// Unescapes the JSON string starting after its opening quote into out, or
+// only counts its bytes if out is NULL. Returns the position after the
+// closing quote, or NULL if the string is malformed.
+static const char *json_string_unescape(const char *p, const char *end, uint8_t *out, size_t *length) {
+	*length = 0;
+	while (p < end && *p != '"') {
+		if (*p != '\\') {
+			if (out) {
+				out[*length] = *p;
+			}
+			++*length;
+			++p;
+			continue;
+		}
+		if (++p == end) {
+			return NULL;
+		}
+		char c = *p++;
+		uint32_t code;
+		switch (c) {
+		case 'b': code = '\b'; break;
+		case 'f': code = '\f'; break;
+		case 'n': code = '\n'; break;
+		case 'r': code = '\r'; break;
+		case 't': code = '\t'; break;
+		case 'u':
+			if (!parse_hex4(p, end, &code)) {
+				return NULL;
+			}
+			p += 4;
+			// a surrogate pair is one code point
+			if (code >= 0xd800 && code < 0xdc00 && end - p >= 6 && p[0] == '\\' && p[1] == 'u') {
+				uint32_t low;
+				if (parse_hex4(p + 2, end, &low) && low >= 0xdc00 && low < 0xe000) {
+					code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+					p += 6;
+				}
+			}
+			break;
+		default:
+			// \" \\ \/
+			code = c;
+			break;
+		}
+		*length += put_utf8(out ? out + *length : NULL, code);
+	}
+	return p < end ? p + 1 : NULL;
+}
+
+static const char *transcode_string(struct cbor_buffer *buffer, const char *p, const char *end) {
+	size_t length;
+	if (!json_string_unescape(p, end, NULL, &length)) {
+		return NULL;
+	}
+	if (!cbor_put_head(buffer, CBOR_MAJOR_TEXT, length) || !cbor_reserve(buffer, length)) {
+		return NULL;
+	}
+	p = json_string_unescape(p, end, buffer->data + buffer->length, &length);
+	buffer->length += length;
+	return p;
+}
+
+static const char *transcode_number(struct cbor_buffer *buffer, const char *p, const char *end) {
+	char number[64];
+	size_t length = 0;
+	bool integer = true;
+	while (p + length < end && p[length]
+			&& (isdigit((unsigned char)p[length]) || strchr("+-.eE", p[length]))) {
+		if (p[length] == '.' || p[length] == 'e' || p[length] == 'E') {
+			integer = false;
+		}
+		if (++length == sizeof(number)) {
+			return NULL;
+		}
+	}
+	memcpy(number, p, length);
+	number[length] = '\0';
+	char *number_end;
+	if (integer) {
+		errno = 0;
+		long long value = strtoll(number, &number_end, 10);
+		if (errno == 0 && *number_end == '\0') {
+			bool ok = value < 0 ?
+				cbor_put_head(buffer, CBOR_MAJOR_NEGINT, -1 - value) :
+				cbor_put_head(buffer, CBOR_MAJOR_UINT, value);
+			return ok ? p + length : NULL;
+		}
+		// too big for an integer, a double loses precision but still fits
+	}
+	double value = strtod(number, &number_end);
+	if (*number_end != '\0' || !cbor_put_double(buffer, value)) {
+		return NULL;
+	}
+	return p + length;
+}
+
+static const char *transcode_literal(struct cbor_buffer *buffer, const char *p, const char *end,
+		const char *literal, uint8_t simple) {
+	size_t length = strlen(literal);
+	if ((size_t)(end - p) < length || memcmp(p, literal, length) != 0
+			|| !cbor_put(buffer, (CBOR_MAJOR_SIMPLE << 5) | simple)) {
+		return NULL;
+	}
+	return p + length;
+}
+
+bool cbor_from_json(struct cbor_buffer *buffer, const char *json, size_t length) {
+	const char *p = json, *end = json + length;
+	int depth = 0;
+	buffer->length = 0;
+	// Nothing has to be remembered per level, the containers are written
+	// with indefinite length and the separators just go away.
+	while (p && p < end) {
+		switch (*p) {
+		case ' ':
+		case '\t':
+		case '\n':
+		case '\r':
+		case ',':
+		case ':':
+			++p;
+			break;
+		case '[':
+		case '{':
+			++depth;
+			p = cbor_put(buffer, *p == '[' ? 0x9f : 0xbf) ? p + 1 : NULL;
+			break;
+		case ']':
+		case '}':
+			if (--depth < 0) {
+				return false;
+			}
+			p = cbor_put(buffer, 0xff) ? p + 1 : NULL;
+			break;
+		case '"':
+			p = transcode_string(buffer, p + 1, end);
+			break;
+		case 't':
+			p = transcode_literal(buffer, p, end, "true", 21);
+			break;
+		case 'f':
+			p = transcode_literal(buffer, p, end, "false", 20);
+			break;
+		case 'n':
+			p = transcode_literal(buffer, p, end, "null", 22);
+			break;
+		case '\0':
+			// the terminator of the JSON string
+			p = end;
+			break;
+		default:
+			if (*p != '-' && !isdigit((unsigned char)*p)) {
+				return false;
+			}
+			p = transcode_number(buffer, p, end);
+			break;
+		}
+	}
+	return p && depth == 0;
+}
+
+void cbor_reader_init(struct cbor_reader *reader, const void *data, size_t length) {
+	reader->data = data;
+	reader->length = length;
+	reader->offset = 0;
+}
+
+static double half_to_double(uint16_t half) {
+	uint64_t sign = (uint64_t)(half >> 15) << 63;
+	int exponent = (half >> 10) & 0x1f;
+	uint64_t mantissa = half & 0x3ff;
+	double value;
+	if (exponent == 0) {
+		// subnormal, exact in a double
+		value = mantissa / 16777216.0;
+		return sign ? -value : value;
+	}
+	uint64_t bits = sign | (mantissa << 42);
+	bits |= exponent == 31 ? (uint64_t)0x7ff << 52 : (uint64_t)(exponent - 15 + 1023) << 52;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+bool cbor_read(struct cbor_reader *reader, struct cbor_item *item) {
+	if (reader->offset >= reader->length) {
+		return false;
+	}
+	uint8_t initial = reader->data[reader->offset++];
+	int major = initial >> 5, info = initial & 0x1f;
+	if (initial == 0xff) {
+		item->type = CBOR_BREAK;
+		return true;
+	}
+	uint64_t value = 0;
+	if (info < 24) {
+		value = info;
+	} else if (info <= 27) {
+		size_t bytes = (size_t)1 << (info - 24);
+		if (reader->length - reader->offset < bytes) {
+			return false;
+		}
+		size_t i;
+		for (i = 0; i < bytes; ++i) {
+			value = (value << 8) | reader->data[reader->offset++];
+		}
+	} else if (info != 31 || (major != CBOR_MAJOR_ARRAY && major != CBOR_MAJOR_MAP)) {
+		// indefinite length strings aren't used by sway
+		return false;
+	}
+
+	switch (major) {
+	case CBOR_MAJOR_UINT:
+		if (value > INT64_MAX) {
+			return false;
+		}
+		item->type = CBOR_INTEGER;
+		item->integer = value;
+		return true;
+	case CBOR_MAJOR_NEGINT:
+		if (value > INT64_MAX) {
+			return false;
+		}
+		item->type = CBOR_INTEGER;
+		item->integer = -1 - (int64_t)value;
+		return true;
+	case CBOR_MAJOR_BYTES:
+	case CBOR_MAJOR_TEXT:
+		if (reader->length - reader->offset < value) {
+			return false;
+		}
+		item->type = CBOR_STRING;
+		item->string = (const char *)reader->data + reader->offset;
+		item->length = value;
+		reader->offset += value;
+		return true;
+	case CBOR_MAJOR_ARRAY:
+	case CBOR_MAJOR_MAP:
+		item->type = major == CBOR_MAJOR_ARRAY ? CBOR_ARRAY : CBOR_MAP;
+		item->length = info == 31 ? CBOR_INDEFINITE : value;
+		return true;
+	case CBOR_MAJOR_TAG:
+		// tags only annotate the item that follows
+		return cbor_read(reader, item);
+	default:
+		break;
+	}
+	switch (info) {
+	case 20:
+	case 21:
+		item->type = CBOR_BOOLEAN;
+		item->boolean = info == 21;
+		return true;
+	case 22:
+	case 23:
+		item->type = CBOR_NULL;
+		return true;
+	case 25:
+		item->type = CBOR_DOUBLE;
+		item->number = half_to_double(value);
+		return true;
+	case 26: {
+		uint32_t bits = value;
+		float number;
+		memcpy(&number, &bits, sizeof(number));
+		item->type = CBOR_DOUBLE;
+		item->number = number;
+		return true;
+	}
+	case 27:
+		item->type = CBOR_DOUBLE;
+		memcpy(&item->number, &value, sizeof(item->number));
+		return true;
+	default:
+		return false;
+	}
+}
+
+bool cbor_skip(struct cbor_reader *reader, const struct cbor_item *item) {
+	if (item->type != CBOR_ARRAY && item->type != CBOR_MAP) {
+		return true;
+	}
+	size_t count = item->length;
+	if (count != CBOR_INDEFINITE && item->type == CBOR_MAP) {
+		count *= 2;
+	}
+	size_t i;
+	for (i = 0; count == CBOR_INDEFINITE || i < count; ++i) {
+		struct cbor_item child;
+		if (!cbor_read(reader, &child)) {
+			return false;
+		}
+		if (child.type == CBOR_BREAK) {
+			return count == CBOR_INDEFINITE;
+		}
+		if (!cbor_skip(reader, &child)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool cbor_string_equal(const struct cbor_item *item, const char *str) {
+	return item->type == CBOR_STRING && strlen(str) == item->length
+		&& memcmp(item->string, str, item->length) == 0;
+}
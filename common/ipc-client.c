@@ -5,26 +5,86 @@
 #include <stdint.h>
 #include <sys/un.h>
 #include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
 #include "log.h"
 #include "stringop.h"
 #include "ipc.h"
 #include "readline.h"
 #include "ipc-client.h"
+#include "list.h"
 
 static const char ipc_magic[] = {'i', '3', '-', 'i', 'p', 'c'};
 static const size_t ipc_header_size = sizeof(ipc_magic)+8;
 
+char *ipc_socketpath_file(void) {
+	// Env var typically set by logind, e.g. "/run/user/<user-id>". Anybody
+	// could plant the file in a shared directory like /tmp.
+	const char *dir = getenv("XDG_RUNTIME_DIR");
+	if (!dir) {
+		return NULL;
+	}
+	const char *fmt = "%s/sway-ipc.%i.path";
+	int len = snprintf(NULL, 0, fmt, dir, getuid());
+	char *path = malloc(len + 1);
+	snprintf(path, len + 1, fmt, dir, getuid());
+	return path;
+}
+
 char *get_socketpath(void) {
+	const char *env = getenv("SWAYSOCK");
+	if (!env) {
+		env = getenv("I3SOCK");
+	}
+	if (env) {
+		return strdup(env);
+	}
+
+	char *line = ipc_read_socketpath_file();
+	// sway might have died without removing the file
+	if (line && access(line, F_OK) == 0) {
+		return line;
+	}
+	free(line);
+
 	FILE *fp = popen("sway --get-socketpath", "r");
 	if (!fp) {
 		return NULL;
 	}
-	char *line = read_line(fp);
+	line = read_line(fp);
 	pclose(fp);
 	return line;
 }
 
+char *ipc_read_socketpath_file(void) {
+	char *path = ipc_socketpath_file();
+	if (!path) {
+		return NULL;
+	}
+	int fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	free(path);
+	if (fd == -1) {
+		return NULL;
+	}
+	// only trust a file the user wrote
+	struct stat st;
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_uid != getuid()) {
+		close(fd);
+		return NULL;
+	}
+	FILE *fp = fdopen(fd, "r");
+	if (!fp) {
+		close(fd);
+		return NULL;
+	}
+	char *line = read_line(fp);
+	fclose(fp);
+	return line;
+}
+
 int ipc_open_socket(const char *socket_path) {
 	struct sockaddr_un addr;
 	int socketfd;
@@ -40,13 +100,40 @@ int ipc_open_socket(const char *socket_path) {
 	return socketfd;
 }
 
+// recv, but keeps a file descriptor passed along with the data in fd
+static ssize_t ipc_recv(int socketfd, char *buf, size_t len, int *fd) {
+	char control[CMSG_SPACE(sizeof(int))];
+	struct iovec iov = { buf, len };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control,
+		.msg_controllen = sizeof(control),
+	};
+	ssize_t received = recvmsg(socketfd, &msg, MSG_CMSG_CLOEXEC);
+	if (received < 0) {
+		return received;
+	}
+	struct cmsghdr *cmsg;
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+			if (*fd != -1) {
+				close(*fd);
+			}
+			memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+		}
+	}
+	return received;
+}
+
 struct ipc_response *ipc_recv_response(int socketfd) {
 	char data[ipc_header_size];
 	uint32_t *data32 = (uint32_t *)(data + sizeof(ipc_magic));
+	int fd = -1;
 
 	size_t total = 0;
 	while (total < ipc_header_size) {
-		ssize_t received = recv(socketfd, data + total, ipc_header_size - total, 0);
+		ssize_t received = ipc_recv(socketfd, data + total, ipc_header_size - total, &fd);
 		if (received < 0) {
 			sway_abort("Unable to receive IPC response");
 		}
@@ -59,7 +146,7 @@ struct ipc_response *ipc_recv_response(int socketfd) {
 	response->type = data32[1];
 	char *payload = malloc(response->size + 1);
 	while (total < response->size) {
-		ssize_t received = recv(socketfd, payload + total, response->size - total, 0);
+		ssize_t received = ipc_recv(socketfd, payload + total, response->size - total, &fd);
 		if (received < 0) {
 			sway_abort("Unable to receive IPC response");
 		}
@@ -67,34 +154,310 @@ struct ipc_response *ipc_recv_response(int socketfd) {
 	}
 	payload[response->size] = '\0';
 	response->payload = payload;
+	response->fd = fd;
 
 	return response;
 }
 
 void free_ipc_response(struct ipc_response *response) {
+	if (response->fd != -1) {
+		close(response->fd);
+	}
 	free(response->payload);
 	free(response);
 }
 
-char *ipc_single_command(int socketfd, uint32_t type, const char *payload, uint32_t *len) {
+void ipc_send_command(int socketfd, uint32_t type, const char *payload, uint32_t len) {
 	char data[ipc_header_size];
 	uint32_t *data32 = (uint32_t *)(data + sizeof(ipc_magic));
 	memcpy(data, ipc_magic, sizeof(ipc_magic));
-	data32[0] = *len;
+	data32[0] = len;
 	data32[1] = type;
 
 	if (write(socketfd, data, ipc_header_size) == -1) {
 		sway_abort("Unable to send IPC header");
 	}
 
-	if (write(socketfd, payload, *len) == -1) {
+	if (write(socketfd, payload, len) == -1) {
 		sway_abort("Unable to send IPC payload");
 	}
+}
+
+char *ipc_single_command(int socketfd, uint32_t type, const char *payload, uint32_t *len) {
+	ipc_send_command(socketfd, type, payload, *len);
 
 	struct ipc_response *resp = ipc_recv_response(socketfd);
 	char *response = resp->payload;
 	*len = resp->size;
+	if (resp->fd != -1) {
+		close(resp->fd);
+	}
 	free(resp);
 
 	return response;
 }
+
+struct ipc_pending_request {
+	ipc_handler handler;
+	void *data;
+};
+
+struct ipc_connection *ipc_connection_create(int socketfd) {
+	int flags = fcntl(socketfd, F_GETFL);
+	if (flags == -1 || fcntl(socketfd, F_SETFL, flags | O_NONBLOCK) == -1) {
+		sway_log_errno(L_ERROR, "Unable to set NONBLOCK on IPC socket");
+		return NULL;
+	}
+	struct ipc_connection *conn = calloc(1, sizeof(struct ipc_connection));
+	conn->fd = socketfd;
+	conn->pending = create_list();
+	conn->fds = create_list();
+	return conn;
+}
+
+void ipc_connection_destroy(struct ipc_connection *conn) {
+	close(conn->fd);
+	free_flat_list(conn->pending);
+	int i;
+	for (i = 0; i < conn->fds->length; ++i) {
+		close((intptr_t)conn->fds->items[i]);
+	}
+	list_free(conn->fds);
+	free(conn->write_buffer);
+	free(conn->read_buffer);
+	free(conn);
+}
+
+void ipc_connection_set_event_handler(struct ipc_connection *conn, ipc_handler handler, void *data) {
+	conn->event_handler = handler;
+	conn->event_data = data;
+}
+
+static void ipc_connection_queue(struct ipc_connection *conn, const char *data, size_t length) {
+	if (conn->write_len + length > conn->write_size) {
+		size_t size = conn->write_size ? conn->write_size : 4096;
+		while (size < conn->write_len + length) {
+			size *= 2;
+		}
+		conn->write_buffer = realloc(conn->write_buffer, size);
+		conn->write_size = size;
+	}
+	memcpy(conn->write_buffer + conn->write_len, data, length);
+	conn->write_len += length;
+}
+
+void ipc_connection_submit(struct ipc_connection *conn, uint32_t type,
+		const char *payload, uint32_t len, ipc_handler handler, void *data) {
+	char header[ipc_header_size];
+	uint32_t *header32 = (uint32_t *)(header + sizeof(ipc_magic));
+	memcpy(header, ipc_magic, sizeof(ipc_magic));
+	header32[0] = len;
+	header32[1] = type;
+	ipc_connection_queue(conn, header, ipc_header_size);
+	if (len) {
+		ipc_connection_queue(conn, payload, len);
+	}
+
+	struct ipc_pending_request *request = malloc(sizeof(struct ipc_pending_request));
+	request->handler = handler;
+	request->data = data;
+	list_add(conn->pending, request);
+
+	ipc_connection_flush(conn);
+}
+
+bool ipc_connection_flush(struct ipc_connection *conn) {
+	size_t written = 0;
+	while (written < conn->write_len) {
+		ssize_t ret = write(conn->fd, conn->write_buffer + written, conn->write_len - written);
+		if (ret == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+			if (errno == EINTR) {
+				continue;
+			}
+			sway_log_errno(L_ERROR, "Unable to send IPC request");
+			return false;
+		}
+		written += ret;
+	}
+	memmove(conn->write_buffer, conn->write_buffer + written, conn->write_len - written);
+	conn->write_len -= written;
+	return true;
+}
+
+// Calls the handler of every complete message in the read buffer.
+static void ipc_connection_handle_messages(struct ipc_connection *conn) {
+	size_t start = 0;
+	while (conn->read_len - start >= ipc_header_size) {
+		char *header = conn->read_buffer + start;
+		uint32_t *header32 = (uint32_t *)(header + sizeof(ipc_magic));
+		if (conn->read_len - start - ipc_header_size < header32[0]) {
+			break;
+		}
+		struct ipc_response response = {
+			.size = header32[0],
+			.type = header32[1],
+			.payload = header + ipc_header_size,
+			.fd = -1,
+		};
+		// the read buffer always has a byte to spare for this
+		char *end = response.payload + response.size;
+		char saved = *end;
+		*end = '\0';
+		start += ipc_header_size + response.size;
+
+		if (response.type & (1u << 31)) {
+			if (conn->event_handler) {
+				conn->event_handler(&response, conn->event_data);
+			}
+		} else if (conn->pending->length) {
+			struct ipc_pending_request *request = conn->pending->items[0];
+			list_del(conn->pending, 0);
+			if (request->handler) {
+				request->handler(&response, request->data);
+			}
+			free(request);
+		} else {
+			sway_log(L_ERROR, "Got an IPC reply without a request");
+		}
+		*end = saved;
+	}
+	memmove(conn->read_buffer, conn->read_buffer + start, conn->read_len - start);
+	conn->read_len -= start;
+}
+
+bool ipc_connection_dispatch(struct ipc_connection *conn) {
+	while (true) {
+		// the next message's size is known once its header is in
+		size_t needed = conn->read_len + 4096;
+		if (conn->read_len >= ipc_header_size) {
+			uint32_t size = *(uint32_t *)(conn->read_buffer + sizeof(ipc_magic));
+			if (ipc_header_size + size > needed) {
+				needed = ipc_header_size + size;
+			}
+		}
+		if (needed + 1 > conn->read_size) {
+			conn->read_size = needed + 1;
+			conn->read_buffer = realloc(conn->read_buffer, conn->read_size);
+		}
+
+		int fd = -1;
+		ssize_t received = ipc_recv(conn->fd, conn->read_buffer + conn->read_len,
+				conn->read_size - 1 - conn->read_len, &fd);
+		if (fd != -1) {
+			list_add(conn->fds, (void *)(intptr_t)fd);
+		}
+		if (received == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				return true;
+			}
+			if (errno == EINTR) {
+				continue;
+			}
+			sway_log_errno(L_ERROR, "Unable to receive IPC response");
+			return false;
+		}
+		if (received == 0) {
+			return false;
+		}
+		conn->read_len += received;
+		ipc_connection_handle_messages(conn);
+	}
+}
+
+int ipc_connection_take_fd(struct ipc_connection *conn) {
+	if (conn->fds->length == 0) {
+		return -1;
+	}
+	int fd = (intptr_t)conn->fds->items[0];
+	list_del(conn->fds, 0);
+	return fd;
+}
+
+// Maps at least size bytes of the region, which only ever grows.
+static bool ipc_state_map_resize(struct ipc_state_map *map, size_t size) {
+	struct stat st;
+	if (fstat(map->fd, &st) == -1 || (size_t)st.st_size < size) {
+		return false;
+	}
+	if (map->shared) {
+		munmap((void *)map->shared, map->size);
+		map->shared = NULL;
+	}
+	void *shared = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, map->fd, 0);
+	if (shared == MAP_FAILED) {
+		sway_log_errno(L_ERROR, "Unable to map sway's shared state");
+		return false;
+	}
+	map->shared = shared;
+	map->size = st.st_size;
+	return true;
+}
+
+struct ipc_state_map *ipc_state_map_create(int fd) {
+	struct ipc_state_map *map = calloc(1, sizeof(struct ipc_state_map));
+	if (!map) {
+		close(fd);
+		return NULL;
+	}
+	map->fd = fd;
+	// odd, never matches a finished update
+	map->seq = 1;
+	if (!ipc_state_map_resize(map, sizeof(struct ipc_state))
+			|| map->shared->magic != IPC_STATE_MAGIC
+			|| map->shared->version != IPC_STATE_VERSION) {
+		sway_log(L_ERROR, "Not a shared state region of a known version");
+		ipc_state_map_destroy(map);
+		return NULL;
+	}
+	return map;
+}
+
+void ipc_state_map_destroy(struct ipc_state_map *map) {
+	if (map->shared) {
+		munmap((void *)map->shared, map->size);
+	}
+	close(map->fd);
+	free(map->snapshot);
+	free(map);
+}
+
+bool ipc_state_map_read(struct ipc_state_map *map) {
+	// sway writes the region from its main loop, a reader has to be very
+	// unlucky to need more than a couple of tries
+	int tries;
+	for (tries = 0; tries < 1000; ++tries) {
+		uint32_t seq = __atomic_load_n(&map->shared->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1) {
+			continue;
+		}
+		if (seq == map->seq) {
+			return false;
+		}
+		size_t size = __atomic_load_n(&map->shared->size, __ATOMIC_RELAXED);
+		if (size < sizeof(struct ipc_state)) {
+			continue;
+		}
+		if (size > map->size && !ipc_state_map_resize(map, size)) {
+			continue;
+		}
+		if (size > map->snapshot_size) {
+			struct ipc_state *snapshot = realloc(map->snapshot, size);
+			if (!snapshot) {
+				return false;
+			}
+			map->snapshot = snapshot;
+			map->snapshot_size = size;
+		}
+		memcpy(map->snapshot, map->shared, size);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&map->shared->seq, __ATOMIC_RELAXED) == seq
+				&& map->snapshot->size == size) {
+			map->seq = seq;
+			return true;
+		}
+	}
+	return false;
+}
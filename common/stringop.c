@@ -143,6 +143,58 @@ char **split_args(const char *start, int *argc) {
 	return argv;
 }
 
+char **split_args_in_place(char *str, int *argc, char **buf, int size) {
+	*argc = 0;
+	char **argv = buf;
+	// same rules as split_args
+	bool in_string = false;
+	bool in_char = false;
+	bool in_brackets = false;
+	bool escaped = false;
+	char *end = str;
+	while (true) {
+		end += strspn(end, whitespace);
+		if (!*end) {
+			break;
+		}
+		char *start = end;
+		for (;; ++end) {
+			if (*end == '"' && !in_char && !escaped) {
+				in_string = !in_string;
+			} else if (*end == '\'' && !in_string && !escaped) {
+				in_char = !in_char;
+			} else if (*end == '[' && !in_string && !in_char && !in_brackets && !escaped) {
+				in_brackets = true;
+			} else if (*end == ']' && !in_string && !in_char && in_brackets && !escaped) {
+				in_brackets = false;
+			} else if (*end == '\\') {
+				escaped = !escaped;
+				continue;
+			} else if (*end == '\0' || (!in_string && !in_char && !in_brackets
+						&& !escaped && strchr(whitespace, *end))) {
+				break;
+			}
+			escaped = false;
+		}
+		escaped = false;
+		if (*end) {
+			*end++ = '\0';
+		}
+		if (*argc + 1 == size) {
+			size *= 2;
+			if (argv == buf) {
+				argv = malloc(sizeof(char *) * size);
+				memcpy(argv, buf, sizeof(char *) * *argc);
+			} else {
+				argv = realloc(argv, sizeof(char *) * size);
+			}
+		}
+		argv[(*argc)++] = start;
+	}
+	argv[*argc] = NULL;
+	return argv;
+}
+
 void free_argv(int argc, char **argv) {
 	while (--argc > 0) {
 		free(argv[argc]);
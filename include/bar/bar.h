@@ -11,8 +11,8 @@ struct bar {
 	struct output *output;
 	/* list_t *outputs; */
 
-	int ipc_event_socketfd;
-	int ipc_socketfd;
+	// replies and events both come in over this one
+	struct ipc_connection *ipc;
 	int status_read_fd;
 	pid_t status_command_pid;
 };
@@ -4,12 +4,14 @@
 #include "bar.h"
 
 /**
- * Initialize ipc connection to sway and get sway state, outputs, bar_config.
+ * Get outputs and bar_config from sway over socketfd, then make it the bar's
+ * ipc connection and subscribe to events.
  */
-void ipc_bar_init(struct bar *bar, int outputi, const char *bar_id);
+void ipc_bar_init(struct bar *bar, int socketfd, int outputi, const char *bar_id);
 
 /**
- * Handle ipc event from sway.
+ * Handle the ipc replies and events that arrived from sway. Returns true if
+ * the bar has to be redrawn.
  */
 bool handle_ipc_event(struct bar *bar);
 
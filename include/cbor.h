@@ -0,0 +1,83 @@
+#ifndef _SWAY_CBOR_H
+#define _SWAY_CBOR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Growable output buffer, meant to be reused from message to message.
+ */
+struct cbor_buffer {
+	uint8_t *data;
+	size_t size, length;
+};
+
+void cbor_buffer_finish(struct cbor_buffer *buffer);
+
+/**
+ * Transcodes JSON text to CBOR (RFC 7049), replacing the contents of buffer.
+ * Arrays and objects become indefinite length arrays and maps, numbers with a
+ * fraction or exponent become doubles. The JSON is expected to be valid, as
+ * sway writes it. Returns false if it isn't.
+ */
+bool cbor_from_json(struct cbor_buffer *buffer, const char *json, size_t length);
+
+enum cbor_type {
+	CBOR_INTEGER,
+	CBOR_DOUBLE,
+	CBOR_STRING,
+	CBOR_ARRAY,
+	CBOR_MAP,
+	CBOR_BOOLEAN,
+	CBOR_NULL,
+	/**
+	 * Ends an array or map of indefinite length.
+	 */
+	CBOR_BREAK,
+};
+
+#define CBOR_INDEFINITE SIZE_MAX
+
+struct cbor_item {
+	enum cbor_type type;
+	int64_t integer;
+	double number;
+	bool boolean;
+	/**
+	 * CBOR_STRING, points into the message and isn't terminated.
+	 */
+	const char *string;
+	/**
+	 * Bytes of a string, items of an array or pairs of a map, or
+	 * CBOR_INDEFINITE.
+	 */
+	size_t length;
+};
+
+/**
+ * Reads CBOR items one after the other, without allocating anything.
+ */
+struct cbor_reader {
+	const uint8_t *data;
+	size_t length, offset;
+};
+
+void cbor_reader_init(struct cbor_reader *reader, const void *data, size_t length);
+/**
+ * Reads the next item. For arrays and maps only their head is read, their
+ * contents are the items that follow. Returns false at the end of the data
+ * or if it isn't valid CBOR.
+ */
+bool cbor_read(struct cbor_reader *reader, struct cbor_item *item);
+/**
+ * Skips the contents of an array or map whose head was just read into item.
+ * Does nothing for other items.
+ */
+bool cbor_skip(struct cbor_reader *reader, const struct cbor_item *item);
+/**
+ * Returns true if a CBOR_STRING item equals str.
+ */
+bool cbor_string_equal(const struct cbor_item *item, const char *str);
+
+#endif
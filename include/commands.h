@@ -37,6 +37,11 @@ struct cmd_results {
  * Parse and handles a command.
  */
 struct cmd_results *handle_command(char *command);
+/**
+ * Handles a command like handle_command, but as one transaction: layout
+ * changes are arranged and IPC events sent once all commands have run.
+ */
+struct cmd_results *handle_command_batch(char *command);
 /**
  * Parse and handles a command during config file loading.
  *
@@ -45,7 +50,8 @@ struct cmd_results *handle_command(char *command);
 struct cmd_results *config_command(char *command, enum cmd_status block);
 
 /**
- * Allocates a cmd_results object.
+ * Creates a cmd_results object. Results with neither input nor error are
+ * shared and don't allocate. Release with free_cmd_results either way.
  */
 struct cmd_results *cmd_results_new(enum cmd_status status, const char* input, const char *error, ...);
 /**
@@ -159,6 +159,7 @@ struct sway_config {
 	list_t *output_configs;
 	list_t *input_configs;
 	list_t *criteria;
+	struct criteria_index *criteria_index;
 	list_t *active_bar_modifiers;
 	struct sway_mode *current_mode;
 	struct bar_config *current_bar;
@@ -181,6 +182,12 @@ struct sway_config {
 	bool edge_gaps;
 	int gaps_inner;
 	int gaps_outer;
+
+	// Bytes an IPC client may have waiting to be read before it's considered
+	// stuck, 0 for no limit. Events to a stuck client are then dropped, or the
+	// client is disconnected.
+	size_t ipc_buffer_limit;
+	bool ipc_buffer_drop;
 };
 
 /**
@@ -68,6 +68,12 @@ struct sway_container {
 	 */
 	double x, y;
 
+	/**
+	 * The geometry last sent to wlc for this view. update_geometry skips the
+	 * wlc call (and the client configure it causes) when nothing changed.
+	 */
+	struct wlc_geometry last_geometry;
+
 	/**
 	 * False if this view is invisible. It could be in the scratchpad or on a
 	 * workspace that is not shown.
@@ -77,6 +83,14 @@ struct sway_container {
 	bool is_focused;
 	bool sticky; // floating view always visible on its output
 
+	/**
+	 * Set when this container has to be arranged again. Ancestors of a dirty
+	 * container get dirty_child set, so the arrange pass only needs to walk
+	 * down the dirty subtrees.
+	 */
+	bool dirty;
+	bool dirty_child;
+
 	// Attributes that mostly views have.
 	char *name;
 	char *class;
@@ -87,6 +101,14 @@ struct sway_container {
 	list_t *bar_pids;
 	pid_t bg_pid;
 
+	// Used by output containers to record frame timings.
+	struct frame_timing *frame_timing;
+
+	// Used by output containers, the desktop_shell background and panels
+	// bound to this output. The configs are owned by desktop_shell.
+	struct background_config *background;
+	list_t *panels;
+
 	int gaps;
 
 	list_t *children;
@@ -25,12 +25,24 @@ struct criteria {
 int criteria_cmp(const void *item, const void *data);
 void free_criteria(struct criteria *crit);
 
+/**
+ * Lookup structure over config->criteria, (re)built by criteria_for when the
+ * list changed.
+ */
+struct criteria_index;
+void free_criteria_index(struct criteria_index *index);
+
 // Pouplate list with crit_tokens extracted from criteria string, returns error
 // string or NULL if successful.
 char *extract_crit_tokens(list_t *tokens, const char *criteria);
+void free_crit_tokens(list_t *crit_tokens);
 
 // Returns list of criteria that match given container. These criteria have
 // been set with `for_window` commands and have an associated cmdlist.
 list_t *criteria_for(swayc_t *cont);
 
+// Returns list of all views matching the criteria tokens, collected in a single
+// walk over the tree.
+list_t *container_for(list_t *tokens);
+
 #endif
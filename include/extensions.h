@@ -5,6 +5,7 @@
 #include <wlc/wlc-wayland.h>
 #include "wayland-desktop-shell-server-protocol.h"
 #include "list.h"
+#include "container.h"
 
 struct background_config {
         wlc_handle output;
@@ -21,6 +22,8 @@ struct panel_config {
         // we need the wl_resource of the surface in the destructor
         struct wl_resource *wl_surface_res;
         enum desktop_shell_panel_position panel_position;
+        // surface size as of the last frame, used to arrange workspaces
+        struct wlc_size size;
 };
 
 struct desktop_shell_state {
@@ -28,7 +31,6 @@ struct desktop_shell_state {
         list_t *panels;
         list_t *lock_surfaces;
         bool is_locked;
-        struct wlc_size panel_size;
 };
 
 struct swaylock_state {
@@ -41,4 +43,10 @@ extern struct desktop_shell_state desktop_shell;
 
 void register_extensions(void);
 
+/**
+ * Fills the background and panel slots of a new output container from the
+ * surfaces already bound to its handle.
+ */
+void desktop_shell_add_output(swayc_t *output);
+
 #endif
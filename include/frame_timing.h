@@ -0,0 +1,60 @@
+#ifndef _SWAY_FRAME_TIMING_H
+#define _SWAY_FRAME_TIMING_H
+
+#include <stdint.h>
+#include <json-c/json.h>
+
+#define FRAME_TIMING_SAMPLES 256
+// Recent damaged frames the refresh period is estimated from.
+#define FRAME_PERIOD_SAMPLES 32
+
+/**
+ * Per-output record of the most recent frames, filled in from the output
+ * pre-render hook. Timestamps come from CLOCK_MONOTONIC, in nanoseconds.
+ */
+struct frame_timing {
+	// Time between the start of a frame and the start of the previous one.
+	uint32_t interval[FRAME_TIMING_SAMPLES];
+	// Time spent in sway's own pre-render work for that frame.
+	uint32_t pre_render[FRAME_TIMING_SAMPLES];
+	int head, length;
+
+	uint64_t last_start;
+	uint64_t current_start;
+	// First damage reported since the last frame started, and the one the
+	// current frame is for. 0 if there was none.
+	uint64_t damage;
+	uint64_t current_damage;
+	// Intervals of the most recent damaged frames since the last reset,
+	// and the shortest of them, 0 until there is one.
+	uint32_t period_interval[FRAME_PERIOD_SAMPLES];
+	int period_head, period_length;
+	uint32_t period;
+
+	uint64_t frames;
+	uint64_t missed;
+};
+
+struct frame_timing *frame_timing_create(void);
+void frame_timing_destroy(struct frame_timing *timing);
+
+/**
+ * Records that sway changed something on the output, so a frame is due.
+ * Only frames sway knows were due count towards missed.
+ */
+void frame_timing_damage(struct frame_timing *timing);
+void frame_timing_begin(struct frame_timing *timing);
+void frame_timing_end(struct frame_timing *timing);
+/**
+ * Forgets the refresh period estimate, for when the output's mode changed.
+ */
+void frame_timing_reset_period(struct frame_timing *timing);
+
+/**
+ * Describes the recorded frames as a json object with p50/p99/max of the
+ * frame interval and pre-render duration (in microseconds) plus the number
+ * of frames produced and missed.
+ */
+json_object *frame_timing_json(const struct frame_timing *timing);
+
+#endif
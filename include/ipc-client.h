@@ -2,8 +2,11 @@
 #define _SWAY_IPC_CLIENT_H
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
 
 #include "ipc.h"
+#include "list.h"
 
 /**
  * IPC response including type of IPC response, size of payload and the json
@@ -13,16 +16,36 @@ struct ipc_response {
 	uint32_t size;
 	uint32_t type;
 	char *payload;
+	/**
+	 * File descriptor passed along with the response, or -1.
+	 */
+	int fd;
 };
 
 /**
- * Gets the path to the IPC socket from sway.
+ * Gets the path to the IPC socket of sway. It's taken from $SWAYSOCK, then
+ * $I3SOCK, then the file sway writes it to on startup, and only then asked
+ * from sway itself.
  */
 char *get_socketpath(void);
+/**
+ * Returns the path of the file sway writes its socket path to, or NULL if
+ * there is none because $XDG_RUNTIME_DIR isn't set.
+ */
+char *ipc_socketpath_file(void);
+/**
+ * Reads the socket path from that file. Returns NULL if there is no such
+ * file or it isn't a regular file owned by the user.
+ */
+char *ipc_read_socketpath_file(void);
 /**
  * Opens the sway socket.
  */
 int ipc_open_socket(const char *socket_path);
+/**
+ * Sends an IPC message without waiting for the response.
+ */
+void ipc_send_command(int socketfd, uint32_t type, const char *payload, uint32_t len);
 /**
  * Issues a single IPC command and returns the buffer. len will be updated with
  * the length of the buffer returned from sway.
@@ -37,4 +60,95 @@ struct ipc_response *ipc_recv_response(int socketfd);
  */
 void free_ipc_response(struct ipc_response *response);
 
+/**
+ * Called with a reply or event of an ipc_connection. The response and its
+ * payload are only valid during the call.
+ */
+typedef void (*ipc_handler)(struct ipc_response *response, void *data);
+
+/**
+ * A non-blocking connection to sway. Requests are queued and sent as the
+ * socket takes them, replies are matched to their requests by order and
+ * events go to the event handler, so one connection serves both.
+ */
+struct ipc_connection {
+	int fd;
+	// requests the socket didn't take yet
+	char *write_buffer;
+	size_t write_size, write_len;
+	// received data not handled yet, starts at a message header
+	char *read_buffer;
+	size_t read_size, read_len;
+	// struct ipc_pending_request of sent requests, oldest first
+	list_t *pending;
+	// file descriptors passed along with replies, oldest first
+	list_t *fds;
+	ipc_handler event_handler;
+	void *event_data;
+};
+
+/**
+ * Makes a non-blocking ipc_connection of a connected socket.
+ */
+struct ipc_connection *ipc_connection_create(int socketfd);
+/**
+ * Closes the socket and frees the connection. Handlers of requests without a
+ * reply yet aren't called.
+ */
+void ipc_connection_destroy(struct ipc_connection *conn);
+/**
+ * Sets the handler events are passed to.
+ */
+void ipc_connection_set_event_handler(struct ipc_connection *conn, ipc_handler handler, void *data);
+/**
+ * Queues a request. handler (if not NULL) is called with the reply from
+ * ipc_connection_dispatch. Requests can be submitted from handlers.
+ */
+void ipc_connection_submit(struct ipc_connection *conn, uint32_t type,
+		const char *payload, uint32_t len, ipc_handler handler, void *data);
+/**
+ * Sends queued requests, as much as the socket takes. Returns false if the
+ * connection failed.
+ */
+bool ipc_connection_flush(struct ipc_connection *conn);
+/**
+ * Reads what is available and calls the handlers of all complete messages.
+ * Call it when the socket is readable. Returns false if sway closed the
+ * connection or it failed.
+ */
+bool ipc_connection_dispatch(struct ipc_connection *conn);
+/**
+ * Returns the oldest file descriptor passed along with a reply, or -1. Which
+ * replies carry one depends on the request (e.g. GET_PIXELS_SHM).
+ */
+int ipc_connection_take_fd(struct ipc_connection *conn);
+
+/**
+ * A read-only mapping of sway's shared state region (see GET_STATE_SHM).
+ * Reading it doesn't involve sway or any syscall unless the region grew.
+ */
+struct ipc_state_map {
+	int fd;
+	const struct ipc_state *shared;
+	size_t size;
+	// seq of the last snapshot copied out
+	uint32_t seq;
+	// the last snapshot copied out, snapshot_size bytes allocated
+	struct ipc_state *snapshot;
+	size_t snapshot_size;
+};
+
+/**
+ * Maps the region behind fd, which the map takes ownership of. Returns NULL
+ * if it isn't a state region of a version this client knows.
+ */
+struct ipc_state_map *ipc_state_map_create(int fd);
+void ipc_state_map_destroy(struct ipc_state_map *map);
+/**
+ * Copies a consistent snapshot to map->snapshot if sway changed the state
+ * since the last call. Returns false if nothing changed (or sway is stuck
+ * in the middle of an update), map->snapshot is left as it was then.
+ */
+bool ipc_state_map_read(struct ipc_state_map *map);
+
 #endif
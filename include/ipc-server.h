@@ -9,7 +9,20 @@ void ipc_init(void);
 void ipc_terminate(void);
 struct sockaddr_un *ipc_user_sockaddr(void);
 
+/**
+ * Returns true if any client is subscribed to the given event, so callers on
+ * hot paths can skip building events nobody listens to.
+ */
+bool ipc_event_subscribed(enum ipc_command_type event);
 void ipc_event_workspace(swayc_t *old, swayc_t *new, const char *change);
+/**
+ * Sends an IPC window event. change is one of "new", "close", "move",
+ * "title", "focus" or "geometry", and the event only carries the fields that
+ * change touched. Window events are numbered by "seq", counting the events
+ * sent to each client, a client that sees a gap (e.g. events dropped by
+ * ipc_buffer_limit) should resync with GET_TREE.
+ */
+void ipc_event_window(swayc_t *window, const char *change);
 void ipc_event_barconfig_update(struct bar_config *bar);
 /**
  * Send IPC mode event to all listening clients
@@ -26,5 +39,26 @@ void ipc_event_modifier(uint32_t modifier, const char *state);
  */
 void ipc_event_binding_keyboard(struct sway_binding *sb);
 const char *swayc_type_string(enum swayc_types type);
+/**
+ * Serializes the tree under root as the GET_TREE reply. The JSON is written
+ * into a buffer that's reused by the next call, NULL if it couldn't grow.
+ */
+const char *ipc_json_describe_tree(swayc_t *root, uint32_t *length);
+
+/**
+ * While a batch is open events are queued instead of sent, and identical
+ * events are only queued once. The queue is sent when the outermost batch
+ * ends.
+ */
+void ipc_event_batch_begin(void);
+void ipc_event_batch_end(void);
+/**
+ * Sends the events queued for clients that get merged events. Events are
+ * queued until the next frame (or a short timeout if nothing renders), and an
+ * event with a merge key (e.g. mode, workspace focus) replaces the queued one
+ * with the same key. Clients that subscribe to "exact" get every event right
+ * away.
+ */
+void ipc_event_flush(void);
 
 #endif
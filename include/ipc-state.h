@@ -0,0 +1,32 @@
+#ifndef _SWAY_IPC_STATE_H
+#define _SWAY_IPC_STATE_H
+
+#include <stdbool.h>
+
+/**
+ * Returns a read-only fd of the shared state region (see struct ipc_state)
+ * to pass to clients, creating the region on first use, or -1 if it couldn't
+ * be created. The fd stays owned by sway.
+ */
+int ipc_state_fd(void);
+/**
+ * Returns true while the shared region exists, i.e. some client may be
+ * reading it.
+ */
+bool ipc_state_active(void);
+/**
+ * Flags that something the snapshot describes may have changed.
+ */
+void ipc_state_changed(void);
+/**
+ * Rebuilds the snapshot and writes it to the shared region if it was flagged
+ * as changed and anything in it did. Does nothing while no client has the
+ * region.
+ */
+void ipc_state_update(void);
+/**
+ * Frees the shared region, the next ipc_state_fd creates a new one.
+ */
+void ipc_state_terminate(void);
+
+#endif
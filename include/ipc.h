@@ -1,6 +1,8 @@
 #ifndef _SWAY_IPC_H
 #define _SWAY_IPC_H
 
+#include <stdint.h>
+
 enum ipc_command_type {
 	IPC_COMMAND = 0,
 	IPC_GET_WORKSPACES = 1,
@@ -20,7 +22,114 @@ enum ipc_command_type {
 	IPC_EVENT_BINDING = (1 << 31 | 5),
 	IPC_EVENT_MODIFIER = (1 << 31 | 6),
 	IPC_EVENT_INPUT = (1 << 31 | 7),
-	IPC_SWAY_GET_PIXELS = 0x81
+	IPC_SWAY_GET_PIXELS = 0x81,
+	IPC_SWAY_GET_GEOMETRY_STATS = 0x82,
+	IPC_SWAY_GET_FRAME_STATS = 0x83,
+	IPC_SWAY_COMMAND_BATCH = 0x84,
+	IPC_SWAY_GET_IPC_STATS = 0x85,
+	IPC_SWAY_GET_PIXELS_SHM = 0x86,
+	IPC_SWAY_GET_STATE_SHM = 0x87,
+	IPC_SWAY_SET_ENCODING = 0x88
+};
+
+/**
+ * How a client gets the replies and events that are JSON by default, set
+ * with SET_ENCODING ("json" or "cbor"). Binary replies like GET_PIXELS are
+ * the same in either.
+ */
+enum ipc_encoding {
+	IPC_ENCODING_JSON = 0,
+	/**
+	 * The JSON transcoded to CBOR (RFC 7049), arrays and objects with
+	 * indefinite length. See cbor.h for a reader.
+	 */
+	IPC_ENCODING_CBOR = 1,
+};
+
+/**
+ * Flags in the first byte of a GET_PIXELS or GET_PIXELS_SHM reply.
+ */
+enum ipc_pixels_flags {
+	IPC_PIXELS_DONE = 1 << 0,
+	/**
+	 * GET_PIXELS_SHM only, the frame is in a new shared buffer. Its fd was
+	 * passed with the reply, the previous one isn't written to anymore.
+	 */
+	IPC_PIXELS_NEW_BUFFER = 1 << 1,
+	/**
+	 * Rows start at the top, as asked for with "top_down". Otherwise they
+	 * start at the bottom as read from GL.
+	 */
+	IPC_PIXELS_TOP_DOWN = 1 << 2,
+	/**
+	 * GET_PIXELS_SHM only, answers a "delta" request. Only tiles that
+	 * changed since the last frame were written to the shared buffer. The
+	 * header is followed by a uint32 tile count, then x, y, width and height
+	 * of each tile as uint32, in rows of the buffer.
+	 */
+	IPC_PIXELS_DELTA = 1 << 3,
+};
+
+#define IPC_PIXELS_TILE_SIZE 64
+
+#define IPC_STATE_MAGIC 0x79617773 // "sway"
+#define IPC_STATE_VERSION 1
+#define IPC_STATE_NAME_SIZE 64
+#define IPC_STATE_TITLE_SIZE 256
+
+/**
+ * Header of the read-only state region handed out with GET_STATE_SHM. It is
+ * followed by output_count struct ipc_state_output, then workspace_count
+ * struct ipc_state_workspace. Strings are truncated and always terminated.
+ */
+struct ipc_state {
+	uint32_t magic;
+	uint32_t version;
+	/**
+	 * Odd while sway writes the region. A copy is consistent if seq was even
+	 * before it was taken and unchanged after.
+	 */
+	uint32_t seq;
+	/**
+	 * Bytes in use, header included. The region only grows, a reader whose
+	 * mapping is smaller has to map it again.
+	 */
+	uint32_t size;
+	uint32_t output_count;
+	uint32_t workspace_count;
+	/** Index of the focused output and workspace, or -1. */
+	int32_t focused_output;
+	int32_t focused_workspace;
+	/** Container id of the focused view as in GET_TREE, or 0. */
+	int64_t focused_view;
+	char focused_title[IPC_STATE_TITLE_SIZE];
+	char mode[IPC_STATE_NAME_SIZE];
+};
+
+struct ipc_state_output {
+	char name[IPC_STATE_NAME_SIZE];
+	int32_t x, y;
+	uint32_t width, height;
+	/** Index of the output's current workspace, or -1. */
+	int32_t current_workspace;
+	uint32_t padding;
+};
+
+enum ipc_state_workspace_flags {
+	IPC_STATE_VISIBLE = 1 << 0,
+	IPC_STATE_FOCUSED = 1 << 1,
+	IPC_STATE_URGENT = 1 << 2,
+};
+
+struct ipc_state_workspace {
+	char name[IPC_STATE_NAME_SIZE];
+	int32_t num;
+	/** Index of the workspace's output. */
+	int32_t output;
+	int32_t x, y;
+	uint32_t width, height;
+	uint32_t flags;
+	uint32_t padding;
 };
 
 #endif
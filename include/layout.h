@@ -1,6 +1,7 @@
 #ifndef _SWAY_LAYOUT_H
 #define _SWAY_LAYOUT_H
 
+#include <stdint.h>
 #include <wlc/wlc.h>
 #include "log.h"
 #include "list.h"
@@ -14,6 +15,17 @@ extern list_t *scratchpad;
 extern int min_sane_w;
 extern int min_sane_h;
 
+/**
+ * Counts of view geometry updates sent to wlc and skipped because the view
+ * already had the computed geometry.
+ */
+struct geometry_stats {
+	uint64_t issued;
+	uint64_t skipped;
+};
+
+extern struct geometry_stats geometry_stats;
+
 // Set initial values for root_container
 void init_layout(void);
 
@@ -56,7 +68,17 @@ void move_workspace_to(swayc_t* workspace, swayc_t* destination);
 
 // Layout
 void update_geometry(swayc_t *view);
+// Arranges container and all of its children, whether they are dirty or not.
 void arrange_windows(swayc_t *container, double width, double height);
+// Flags container to be arranged by the next arrange_dirty_windows.
+void layout_mark_dirty(swayc_t *container);
+// Arranges all dirty containers, clean subtrees are not touched.
+void arrange_dirty_windows(void);
+// While a batch is open arrange_windows only marks the container dirty, the
+// dirty subtrees are arranged once when the outermost batch ends. Batches nest.
+// Geometry is stale until then, code that reads it calls arrange_dirty_windows.
+void layout_batch_begin(void);
+void layout_batch_end(void);
 
 swayc_t *get_focused_container(swayc_t *parent);
 swayc_t *get_swayc_in_direction(swayc_t *container, enum movement_direction dir);
@@ -25,6 +25,11 @@ void free_flat_list(list_t *list);
 char **split_args(const char *str, int *argc);
 void free_argv(int argc, char **argv);
 
+// Like split_args, but splits str in place by terminating each token. The
+// tokens are stored in buf (size pointers, NULL terminated) if they fit,
+// otherwise in a new array the caller has to free if it isn't buf.
+char **split_args_in_place(char *str, int *argc, char **buf, int size);
+
 char *code_strchr(const char *string, char delimiter);
 char *code_strstr(const char *haystack, const char *needle);
 int unescape_string(char *string);
@@ -55,6 +55,7 @@ static sway_cmd cmd_for_window;
 static sway_cmd cmd_fullscreen;
 static sway_cmd cmd_gaps;
 static sway_cmd cmd_input;
+static sway_cmd cmd_ipc_buffer_limit;
 static sway_cmd cmd_kill;
 static sway_cmd cmd_layout;
 static sway_cmd cmd_log_colors;
@@ -1948,6 +1949,32 @@ static struct cmd_results *cmd_workspace(int argc, char **argv) {
 	return cmd_results_new(CMD_SUCCESS, NULL, NULL);
 }
 
+static struct cmd_results *cmd_ipc_buffer_limit(int argc, char **argv) {
+	struct cmd_results *error = NULL;
+	if ((error = checkarg(argc, "ipc_buffer_limit", EXPECTED_AT_LEAST, 1))) {
+		return error;
+	}
+	if ((error = checkarg(argc, "ipc_buffer_limit", EXPECTED_LESS_THAN, 3))) {
+		return error;
+	}
+	char *end;
+	long long limit = strtoll(argv[0], &end, 10);
+	if (*end || limit < 0) {
+		return cmd_results_new(CMD_INVALID, "ipc_buffer_limit", "Expected 'ipc_buffer_limit <bytes> [drop|disconnect]'");
+	}
+	if (argc == 2) {
+		if (strcasecmp(argv[1], "drop") == 0) {
+			config->ipc_buffer_drop = true;
+		} else if (strcasecmp(argv[1], "disconnect") == 0) {
+			config->ipc_buffer_drop = false;
+		} else {
+			return cmd_results_new(CMD_INVALID, "ipc_buffer_limit", "Expected 'ipc_buffer_limit <bytes> [drop|disconnect]'");
+		}
+	}
+	config->ipc_buffer_limit = limit;
+	return cmd_results_new(CMD_SUCCESS, NULL, NULL);
+}
+
 static struct cmd_results *cmd_ws_auto_back_and_forth(int argc, char **argv) {
 	struct cmd_results *error = NULL;
 	if ((error = checkarg(argc, "workspace_auto_back_and_forth", EXPECTED_EQUAL_TO, 1))) {
@@ -1982,6 +2009,7 @@ static struct cmd_handler handlers[] = {
 	{ "fullscreen", cmd_fullscreen },
 	{ "gaps", cmd_gaps },
 	{ "input", cmd_input },
+	{ "ipc_buffer_limit", cmd_ipc_buffer_limit },
 	{ "kill", cmd_kill },
 	{ "layout", cmd_layout },
 	{ "log_colors", cmd_log_colors },
@@ -2744,35 +2772,279 @@ static struct cmd_handler bar_colors_handlers[] = {
 	{ "urgent_workspace", bar_colors_cmd_urgent_workspace },
 };
 
-static int handler_compare(const void *_a, const void *_b) {
-	const struct cmd_handler *a = _a;
-	const struct cmd_handler *b = _b;
-	return strcasecmp(a->command, b->command);
+/**
+ * Perfect hash over one of the handler tables above, built on first lookup
+ * (hash and displace). Keys first go to a bucket by their unseeded hash, each
+ * bucket then gets the smallest seed that puts all of its keys into free slots.
+ */
+struct handler_table {
+	struct cmd_handler *handlers;
+	size_t length;
+	size_t buckets, slots; // powers of two
+	uint32_t *seeds; // per bucket
+	struct cmd_handler **slot;
+	// no seeds were found, handlers are searched one by one
+	bool linear;
+};
+
+// Seeds tried per bucket before giving up on the hash table. Any table
+// that fits here takes a few dozen at most.
+#define HANDLER_SEED_LIMIT 0x10000
+
+// Case-insensitive FNV-1a, commands are matched with strcasecmp
+static uint32_t handler_hash(const char *key, uint32_t seed) {
+	uint32_t hash = 2166136261u ^ (seed * 2654435761u);
+	for (; *key; ++key) {
+		hash ^= (unsigned char)tolower((unsigned char)*key);
+		hash *= 16777619u;
+	}
+	// the low bits of FNV only depend on the low bits of each character, mix
+	// so that every bit of the key reaches the slot index (murmur3 finalizer)
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bu;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35u;
+	hash ^= hash >> 16;
+	return hash;
+}
+
+static int bucket_size_compare(const void *_a, const void *_b) {
+	const list_t *a = *(list_t * const *)_a;
+	const list_t *b = *(list_t * const *)_b;
+	return b->length - a->length;
+}
+
+static void handler_table_build(struct handler_table *table) {
+	size_t i, j;
+	table->buckets = 1;
+	while (table->buckets < table->length / 2 + 1) {
+		table->buckets *= 2;
+	}
+	table->slots = 1;
+	while (table->slots < table->length * 2) {
+		table->slots *= 2;
+	}
+	table->seeds = calloc(table->buckets, sizeof(uint32_t));
+	table->slot = calloc(table->slots, sizeof(struct cmd_handler *));
+
+	list_t **buckets = malloc(table->buckets * sizeof(list_t *));
+	for (i = 0; i < table->buckets; ++i) {
+		buckets[i] = create_list();
+	}
+	for (i = 0; i < table->length; ++i) {
+		struct cmd_handler *handler = &table->handlers[i];
+		list_add(buckets[handler_hash(handler->command, 0) & (table->buckets - 1)], handler);
+	}
+	// remember which bucket is which before sorting, largest buckets first
+	list_t **sorted = malloc(table->buckets * sizeof(list_t *));
+	memcpy(sorted, buckets, table->buckets * sizeof(list_t *));
+	qsort(sorted, table->buckets, sizeof(list_t *), bucket_size_compare);
+
+	size_t *taken = malloc(table->length * sizeof(size_t));
+	for (i = 0; i < table->buckets && sorted[i]->length; ++i) {
+		list_t *bucket = sorted[i];
+		size_t index = handler_hash(((struct cmd_handler *)bucket->items[0])->command, 0)
+			& (table->buckets - 1);
+		uint32_t seed = 1;
+		for (; seed < HANDLER_SEED_LIMIT; ++seed) {
+			for (j = 0; j < (size_t)bucket->length; ++j) {
+				struct cmd_handler *handler = bucket->items[j];
+				size_t s = handler_hash(handler->command, seed) & (table->slots - 1);
+				size_t k;
+				for (k = 0; k < j && taken[k] != s; ++k);
+				if (table->slot[s] || k < j) {
+					break;
+				}
+				taken[j] = s;
+			}
+			if (j == (size_t)bucket->length) {
+				break;
+			}
+		}
+		if (!sway_assert(seed < HANDLER_SEED_LIMIT, "No hash seed for %d commands like '%s'",
+				bucket->length, ((struct cmd_handler *)bucket->items[0])->command)) {
+			table->linear = true;
+			break;
+		}
+		table->seeds[index] = seed;
+		for (j = 0; j < (size_t)bucket->length; ++j) {
+			table->slot[taken[j]] = bucket->items[j];
+		}
+	}
+	free(taken);
+	free(sorted);
+	for (i = 0; i < table->buckets; ++i) {
+		list_free(buckets[i]);
+	}
+	free(buckets);
+}
+
+static struct cmd_handler *handler_table_find(struct handler_table *table, const char *line) {
+	if (!table->slot) {
+		handler_table_build(table);
+	}
+	if (table->linear) {
+		size_t i;
+		for (i = 0; i < table->length; ++i) {
+			if (strcasecmp(table->handlers[i].command, line) == 0) {
+				return &table->handlers[i];
+			}
+		}
+		return NULL;
+	}
+	uint32_t seed = table->seeds[handler_hash(line, 0) & (table->buckets - 1)];
+	if (!seed) {
+		return NULL;
+	}
+	struct cmd_handler *handler = table->slot[handler_hash(line, seed) & (table->slots - 1)];
+	if (handler && strcasecmp(handler->command, line) == 0) {
+		return handler;
+	}
+	return NULL;
 }
 
+#define HANDLER_TABLE(table) { table, sizeof(table) / sizeof(struct cmd_handler), 0, 0, NULL, NULL, false }
+
+static struct handler_table handler_table = HANDLER_TABLE(handlers);
+static struct handler_table bar_handler_table = HANDLER_TABLE(bar_handlers);
+static struct handler_table input_handler_table = HANDLER_TABLE(input_handlers);
+static struct handler_table bar_colors_handler_table = HANDLER_TABLE(bar_colors_handlers);
+
 static struct cmd_handler *find_handler(char *line, enum cmd_status block) {
-	struct cmd_handler d = { .command=line };
-	struct cmd_handler *res = NULL;
 	sway_log(L_DEBUG, "find_handler(%s) %d", line, block == CMD_BLOCK_INPUT);
 	if (block == CMD_BLOCK_BAR) {
-		res = bsearch(&d, bar_handlers,
-			sizeof(bar_handlers) / sizeof(struct cmd_handler),
-			sizeof(struct cmd_handler), handler_compare);
+		return handler_table_find(&bar_handler_table, line);
 	} else if (block == CMD_BLOCK_BAR_COLORS){
-		res = bsearch(&d, bar_colors_handlers,
-			sizeof(bar_colors_handlers) / sizeof(struct cmd_handler),
-			sizeof(struct cmd_handler), handler_compare);
+		return handler_table_find(&bar_colors_handler_table, line);
 	} else if (block == CMD_BLOCK_INPUT) {
 		sway_log(L_DEBUG, "lookng at input handlers");
-		res = bsearch(&d, input_handlers,
-			sizeof(input_handlers) / sizeof(struct cmd_handler),
-			sizeof(struct cmd_handler), handler_compare);
+		return handler_table_find(&input_handler_table, line);
 	} else {
-		res = bsearch(&d, handlers,
-			sizeof(handlers) / sizeof(struct cmd_handler),
-			sizeof(struct cmd_handler), handler_compare);
+		return handler_table_find(&handler_table, line);
+	}
+}
+
+// These read container geometry, which arrange_windows doesn't update while a
+// layout batch is open. Dirty containers are arranged before they run.
+static bool handler_reads_geometry(const struct cmd_handler *handler) {
+	return handler->handle == cmd_floating
+		|| handler->handle == cmd_move
+		|| handler->handle == cmd_resize
+		|| handler->handle == cmd_scratchpad
+		|| handler->handle == cmd_split
+		|| handler->handle == cmd_splith
+		|| handler->handle == cmd_splitt
+		|| handler->handle == cmd_splitv;
+}
+
+// Runs each command of a comma separated command list. Returns false and sets
+// results to the error if a command fails.
+static bool handle_command_list(char *cmdlist, struct cmd_results **results) {
+	cmdlist += strspn(cmdlist, whitespace);
+	do {
+		// Split commands
+		char *cmd = argsep(&cmdlist, ",");
+		cmd += strspn(cmd, whitespace);
+		if (strcmp(cmd, "") == 0) {
+			sway_log(L_INFO, "Ignoring empty command.");
+			continue;
+		}
+		sway_log(L_INFO, "Handling command '%s'", cmd);
+		// cmd isn't needed once split, tokenize it in place. Handlers copy
+		// whatever they keep from argv.
+		int argc;
+		char *buf[16];
+		char **argv = split_args_in_place(cmd, &argc, buf, 16);
+		struct cmd_handler *handler = find_handler(argv[0], CMD_BLOCK_END);
+		struct cmd_results *res = NULL;
+		if (!handler) {
+			char *input = join_args(argv, argc);
+			res = cmd_results_new(CMD_INVALID, input, "Unknown/invalid command");
+			free(input);
+		} else {
+			int i;
+			for (i = 1; i < argc; ++i) {
+				if (*argv[i] == '\"' || *argv[i] == '\'') {
+					strip_quotes(argv[i]);
+				}
+			}
+			if (handler_reads_geometry(handler)) {
+				arrange_dirty_windows();
+			}
+			res = handler->handle(argc-1, argv+1);
+		}
+		if (argv != buf) {
+			free(argv);
+		}
+		if (res->status != CMD_SUCCESS) {
+			if (*results) {
+				free_cmd_results(*results);
+			}
+			*results = res;
+			return false;
+		}
+		free_cmd_results(res);
+	} while(cmdlist);
+	return true;
+}
+
+// Runs the command list once for every view matching the criteria tokens, with
+// that view focused, as the handlers act on the focused container. Focus goes
+// back to where it was afterwards, like i3 keeps it: to the previously focused
+// view if it's still on the same workspace, or else to that workspace. Matches
+// that can't be focused (a fullscreen view on their workspace) are reported.
+static bool handle_command_list_for(list_t *tokens, const char *cmdlist, struct cmd_results **results) {
+	list_t *views = container_for(tokens);
+	// Commands may destroy containers, so hold on to handles rather than
+	// pointers and look them up again before use.
+	wlc_handle *handles = malloc(views->length * sizeof(wlc_handle));
+	int count = views->length, i;
+	for (i = 0; i < count; ++i) {
+		handles[i] = ((swayc_t *)views->items[i])->handle;
+	}
+	list_free(views);
+
+	swayc_t *focused = get_focused_container(&root_container);
+	wlc_handle focused_handle = focused->type == C_VIEW ? focused->handle : 0;
+	swayc_t *ws = swayc_active_workspace();
+	char *focused_ws = ws && ws->name ? strdup(ws->name) : NULL;
+
+	bool success = true;
+	int skipped = 0;
+	for (i = 0; i < count && success; ++i) {
+		swayc_t *view = swayc_by_handle(handles[i]);
+		if (!view) {
+			// destroyed by the commands run for an earlier match
+			continue;
+		}
+		if (!set_focused_container(view)) {
+			++skipped;
+			continue;
+		}
+		char *cmds = strdup(cmdlist);
+		success = handle_command_list(cmds, results);
+		free(cmds);
 	}
-	return res;
+
+	focused = focused_handle ? swayc_by_handle(focused_handle) : NULL;
+	ws = focused_ws ? workspace_by_name(focused_ws) : NULL;
+	if (focused && (!ws || swayc_parent_by_type(focused, C_WORKSPACE) == ws)) {
+		set_focused_container(focused);
+	} else if (ws) {
+		workspace_switch(ws);
+	}
+	if (success && skipped) {
+		if (*results) {
+			free_cmd_results(*results);
+		}
+		*results = cmd_results_new(CMD_FAILURE, cmdlist,
+			"%d of %d matching views skipped, their workspace has a fullscreen view",
+			skipped, count);
+		success = false;
+	}
+	free(focused_ws);
+	free(handles);
+	return success;
 }
 
 struct cmd_results *handle_command(char *_exec) {
@@ -2783,8 +3055,8 @@ struct cmd_results *handle_command(char *_exec) {
 	char *exec = strdup(_exec);
 	char *head = exec;
 	char *cmdlist;
-	char *cmd;
-	char *criteria __attribute__((unused));
+	char *criteria;
+	list_t *tokens = NULL;
 
 	head = exec;
 	do {
@@ -2795,7 +3067,22 @@ struct cmd_results *handle_command(char *_exec) {
 			criteria = argsep(&head, "]");
 			if (head) {
 				++head;
-				// TODO handle criteria
+				tokens = create_list();
+				char *error = extract_crit_tokens(tokens, criteria);
+				if (error) {
+					if (results) {
+						free_cmd_results(results);
+					}
+					results = cmd_results_new(CMD_INVALID, criteria, "%s", error);
+					free(error);
+					goto cleanup;
+				} else if (tokens->length == 0) {
+					if (results) {
+						free_cmd_results(results);
+					}
+					results = cmd_results_new(CMD_INVALID, criteria, "Found no name/value pairs in criteria");
+					goto cleanup;
+				}
 			} else {
 				if (!results) {
 					results = cmd_results_new(CMD_INVALID, criteria, "Unmatched [");
@@ -2804,63 +3091,24 @@ struct cmd_results *handle_command(char *_exec) {
 			}
 			// Skip leading whitespace
 			head += strspn(head, whitespace);
-
-			// TODO: it will yield unexpected results to execute commands
-			// (on any view) that where meant for certain views only.
-			if (!results) {
-				int len = strlen(criteria) + strlen(head) + 4;
-				char *tmp = malloc(len);
-				snprintf(tmp, len, "[%s] %s", criteria, head);
-				results = cmd_results_new(CMD_INVALID, tmp,
-					"Can't handle criteria string: Refusing to execute command");
-				free(tmp);
-			}
-			goto cleanup;
 		}
 		// Split command list
 		cmdlist = argsep(&head, ";");
-		cmdlist += strspn(cmdlist, whitespace);
-		do {
-			// Split commands
-			cmd = argsep(&cmdlist, ",");
-			cmd += strspn(cmd, whitespace);
-			if (strcmp(cmd, "") == 0) {
-				sway_log(L_INFO, "Ignoring empty command.");
-				continue;
-			}
-			sway_log(L_INFO, "Handling command '%s'", cmd);
-			//TODO better handling of argv
-			int argc;
-			char **argv = split_args(cmd, &argc);
-			int i;
-			for (i = 1; i < argc; ++i) {
-				if (*argv[i] == '\"' || *argv[i] == '\'') {
-					strip_quotes(argv[i]);
-				}
-			}
-			struct cmd_handler *handler = find_handler(argv[0], CMD_BLOCK_END);
-			if (!handler) {
-				if (results) {
-					free_cmd_results(results);
-				}
-				results = cmd_results_new(CMD_INVALID, cmd, "Unknown/invalid command");
-				free_argv(argc, argv);
-				goto cleanup;
-			}
-			struct cmd_results *res = handler->handle(argc-1, argv+1);
-			if (res->status != CMD_SUCCESS) {
-				free_argv(argc, argv);
-				if (results) {
-					free_cmd_results(results);
-				}
-				results = res;
+		if (tokens) {
+			bool success = handle_command_list_for(tokens, cmdlist, &results);
+			free_crit_tokens(tokens);
+			tokens = NULL;
+			if (!success) {
 				goto cleanup;
 			}
-			free_argv(argc, argv);
-			free_cmd_results(res);
-		} while(cmdlist);
+		} else if (!handle_command_list(cmdlist, &results)) {
+			goto cleanup;
+		}
 	} while(head);
 	cleanup:
+	if (tokens) {
+		free_crit_tokens(tokens);
+	}
 	free(exec);
 	if (!results) {
 		results = cmd_results_new(CMD_SUCCESS, NULL, NULL);
@@ -2868,6 +3116,15 @@ struct cmd_results *handle_command(char *_exec) {
 	return results;
 }
 
+struct cmd_results *handle_command_batch(char *exec) {
+	layout_batch_begin();
+	ipc_event_batch_begin();
+	struct cmd_results *results = handle_command(exec);
+	layout_batch_end();
+	ipc_event_batch_end();
+	return results;
+}
+
 // this is like handle_command above, except:
 // 1) it ignores empty commands (empty lines)
 // 2) it does variable substitution
@@ -2917,33 +3174,55 @@ struct cmd_results *config_command(char *exec, enum cmd_status block) {
 	return results;
 }
 
+// Results without input or error carry nothing but the status, share them
+// instead of allocating one per command.
+static struct cmd_results plain_results[] = {
+	{ CMD_SUCCESS, NULL, NULL },
+	{ CMD_FAILURE, NULL, NULL },
+	{ CMD_INVALID, NULL, NULL },
+	{ CMD_DEFER, NULL, NULL },
+	{ CMD_BLOCK_END, NULL, NULL },
+	{ CMD_BLOCK_MODE, NULL, NULL },
+	{ CMD_BLOCK_BAR, NULL, NULL },
+	{ CMD_BLOCK_BAR_COLORS, NULL, NULL },
+	{ CMD_BLOCK_INPUT, NULL, NULL },
+};
+
 struct cmd_results *cmd_results_new(enum cmd_status status, const char* input, const char *format, ...) {
-	struct cmd_results *results = malloc(sizeof(struct cmd_results));
+	if (!input && !format) {
+		return &plain_results[status];
+	}
+	// input and error live in the same allocation as the results
+	size_t input_len = input ? strlen(input) + 1 : 0;
+	size_t error_len = 0;
+	va_list args;
+	if (format) {
+		va_start(args, format);
+		error_len = vsnprintf(NULL, 0, format, args) + 1;
+		va_end(args);
+	}
+	struct cmd_results *results = malloc(sizeof(struct cmd_results) + input_len + error_len);
+	char *data = (char *)(results + 1);
 	results->status = status;
+	results->input = NULL;
+	results->error = NULL;
 	if (input) {
-		results->input = strdup(input); // input is the command name
-	} else {
-		results->input = NULL;
+		results->input = memcpy(data, input, input_len); // input is the command name
+		data += input_len;
 	}
 	if (format) {
-		char *error = malloc(256);
-		va_list args;
 		va_start(args, format);
-		vsnprintf(error, 256, format, args);
+		vsnprintf(data, error_len, format, args);
 		va_end(args);
-		results->error = error;
-	} else {
-		results->error = NULL;
+		results->error = data;
 	}
 	return results;
 }
 
 void free_cmd_results(struct cmd_results *results) {
-	if (results->input) {
-		free(results->input);
-	}
-	if (results->error) {
-		free(results->error);
+	if (results >= plain_results
+			&& results < plain_results + sizeof(plain_results) / sizeof(*plain_results)) {
+		return;
 	}
 	free(results);
 }
@@ -107,6 +107,7 @@ static void free_config(struct sway_config *config) {
 		free_criteria(config->criteria->items[i]);
 	}
 	list_free(config->criteria);
+	free_criteria_index(config->criteria_index);
 
 	for (i = 0; i < config->input_configs->length; ++i) {
 		free_input_config(config->input_configs->items[i]);
@@ -133,6 +134,7 @@ static void config_defaults(struct sway_config *config) {
 	config->bars = create_list();
 	config->workspace_outputs = create_list();
 	config->criteria = create_list();
+	config->criteria_index = NULL;
 	config->input_configs = create_list();
 	config->output_configs = create_list();
 
@@ -163,6 +165,9 @@ static void config_defaults(struct sway_config *config) {
 	config->gaps_inner = 0;
 	config->gaps_outer = 0;
 
+	config->ipc_buffer_limit = 4 * 1024 * 1024;
+	config->ipc_buffer_drop = true;
+
 	config->active_bar_modifiers = create_list();
 }
 
@@ -368,7 +373,7 @@ bool read_config(FILE *file, bool is_active) {
 		default:;
 		}
 		free(line);
-		free(res);
+		free_cmd_results(res);
 	}
 
 	if (is_active) {
@@ -10,11 +10,155 @@
 #include "focus.h"
 #include "layout.h"
 #include "input_state.h"
+#include "frame_timing.h"
+#include "extensions.h"
+#include "ipc-server.h"
 #include "log.h"
 
 #define ASSERT_NONNULL(PTR) \
 	sway_assert (PTR, #PTR "must be non-null")
 
+/**
+ * Index of every output and view container by its wlc_handle, so that the
+ * wlc callbacks don't have to walk the whole tree to find their container.
+ *
+ * Open addressing with linear probing, the capacity is always a power of two.
+ */
+struct handle_entry {
+	wlc_handle handle;
+	swayc_t *cont;
+};
+
+static struct {
+	size_t capacity;
+	size_t length;
+	struct handle_entry *entries;
+} handle_index;
+
+static size_t handle_hash(wlc_handle handle) {
+	// fibonacci hashing, handles are mostly small sequential integers
+	return (size_t)((uint64_t)handle * 11400714819323198485llu >> 32);
+}
+
+static void handle_index_insert(wlc_handle handle, swayc_t *cont);
+
+static void handle_index_grow(void) {
+	size_t old_capacity = handle_index.capacity;
+	struct handle_entry *old = handle_index.entries;
+	handle_index.capacity = old_capacity ? old_capacity * 2 : 64;
+	handle_index.entries = calloc(handle_index.capacity, sizeof(struct handle_entry));
+	handle_index.length = 0;
+	for (size_t i = 0; i < old_capacity; ++i) {
+		if (old[i].cont) {
+			handle_index_insert(old[i].handle, old[i].cont);
+		}
+	}
+	free(old);
+}
+
+static void handle_index_insert(wlc_handle handle, swayc_t *cont) {
+	// keep the load factor below 1/2
+	if ((handle_index.length + 1) * 2 > handle_index.capacity) {
+		handle_index_grow();
+	}
+	size_t mask = handle_index.capacity - 1;
+	size_t i = handle_hash(handle) & mask;
+	while (handle_index.entries[i].cont && handle_index.entries[i].handle != handle) {
+		i = (i + 1) & mask;
+	}
+	if (!handle_index.entries[i].cont) {
+		++handle_index.length;
+	}
+	handle_index.entries[i].handle = handle;
+	handle_index.entries[i].cont = cont;
+}
+
+static struct handle_entry *handle_index_find(wlc_handle handle) {
+	if (!handle_index.capacity) {
+		return NULL;
+	}
+	size_t mask = handle_index.capacity - 1;
+	size_t i = handle_hash(handle) & mask;
+	while (handle_index.entries[i].cont) {
+		if (handle_index.entries[i].handle == handle) {
+			return &handle_index.entries[i];
+		}
+		i = (i + 1) & mask;
+	}
+	return NULL;
+}
+
+static void handle_index_remove(wlc_handle handle, swayc_t *cont) {
+	struct handle_entry *entry = handle_index_find(handle);
+	if (!entry || entry->cont != cont) {
+		return;
+	}
+	// backward shift deletion, moves following entries of the probe sequence
+	// into the hole so lookups never need tombstones
+	size_t mask = handle_index.capacity - 1;
+	size_t hole = entry - handle_index.entries;
+	size_t i = hole;
+	while (true) {
+		i = (i + 1) & mask;
+		struct handle_entry *next = &handle_index.entries[i];
+		if (!next->cont) {
+			break;
+		}
+		size_t home = handle_hash(next->handle) & mask;
+		// move next into the hole unless its home lies cyclically in (hole, i]
+		if ((i > hole && (home <= hole || home > i))
+				|| (i < hole && home <= hole && home > i)) {
+			handle_index.entries[hole] = *next;
+			hole = i;
+		}
+	}
+	handle_index.entries[hole].handle = 0;
+	handle_index.entries[hole].cont = NULL;
+	--handle_index.length;
+}
+
+#if SWAY_TREE_CHECKS
+static swayc_t *_swayc_by_handle_helper(wlc_handle handle, swayc_t *parent);
+
+static void handle_index_count(swayc_t *cont, void *data) {
+	if ((cont->type == C_VIEW || cont->type == C_OUTPUT) && cont->handle != (wlc_handle)-1) {
+		struct handle_entry *entry = handle_index_find(cont->handle);
+		sway_assert(entry && entry->cont == cont,
+			"container %p (handle %lu) missing from handle index", cont, cont->handle);
+		++*(size_t *)data;
+	}
+}
+
+/**
+ * Checks the handle index against the tree. Views that have been taken out of
+ * the tree (e.g. into the scratchpad) are still indexed but must not be
+ * reachable from root_container.
+ */
+static void handle_index_check(void) {
+	size_t in_tree = 0, detached = 0;
+	container_map(&root_container, handle_index_count, &in_tree);
+	for (size_t i = 0; i < handle_index.capacity; ++i) {
+		struct handle_entry *entry = &handle_index.entries[i];
+		if (!entry->cont) {
+			continue;
+		}
+		if (!entry->cont->parent) {
+			++detached;
+			continue;
+		}
+		sway_assert(_swayc_by_handle_helper(entry->handle, &root_container) == entry->cont,
+			"handle index entry %lu points to %p which is not in the tree",
+			entry->handle, entry->cont);
+	}
+	sway_assert(in_tree + detached == handle_index.length,
+		"handle index has %zu entries, tree has %zu (+%zu detached)",
+		handle_index.length, in_tree, detached);
+}
+#else
+static void handle_index_check(void) {
+}
+#endif
+
 static swayc_t *new_swayc(enum swayc_types type) {
 	swayc_t *c = calloc(1, sizeof(swayc_t));
 	c->handle = -1;
@@ -31,6 +175,9 @@ static void free_swayc(swayc_t *cont) {
 	if (!ASSERT_NONNULL(cont)) {
 		return;
 	}
+	if (cont->type == C_VIEW || cont->type == C_OUTPUT) {
+		handle_index_remove(cont->handle, cont);
+	}
 	if (cont->children) {
 		// remove children until there are no more, free_swayc calls
 		// remove_child, which removes child from this container
@@ -64,6 +211,12 @@ static void free_swayc(swayc_t *cont) {
 		terminate_swaybars(cont->bar_pids);
 		free_flat_list(cont->bar_pids);
 	}
+	if (cont->frame_timing) {
+		frame_timing_destroy(cont->frame_timing);
+	}
+	if (cont->panels) {
+		list_free(cont->panels);
+	}
 	if (cont->bg_pid != 0) {
 		terminate_swaybg(cont->bg_pid);
 	}
@@ -112,11 +265,15 @@ swayc_t *new_output(wlc_handle handle) {
 
 	swayc_t *output = new_swayc(C_OUTPUT);
 	output->handle = handle;
+	handle_index_insert(handle, output);
 	output->name = name ? strdup(name) : NULL;
 	output->width = size->w;
 	output->height = size->h;
 	output->unmanaged = create_list();
 	output->bar_pids = create_list();
+	output->frame_timing = frame_timing_create();
+	output->panels = create_list();
+	desktop_shell_add_output(output);
 	output->bg_pid = 0;
 
 	apply_output_config(oc, output);
@@ -150,6 +307,7 @@ swayc_t *new_output(wlc_handle handle) {
 
 	free(ws_name);
 
+	handle_index_check();
 	return output;
 }
 
@@ -255,6 +413,7 @@ swayc_t *new_view(swayc_t *sibling, wlc_handle handle) {
 		handle, title, sibling, sibling ? sibling->type : 0);
 	// Setup values
 	view->handle = handle;
+	handle_index_insert(handle, view);
 	view->name = title ? strdup(title) : NULL;
 	const char *class = wlc_view_get_class(handle);
 	view->class = class ? strdup(class) : NULL;
@@ -279,6 +438,8 @@ swayc_t *new_view(swayc_t *sibling, wlc_handle handle) {
 		// Regular case, create as sibling of current container
 		add_sibling(sibling, view);
 	}
+	handle_index_check();
+	ipc_event_window(view, "new");
 	return view;
 }
 
@@ -292,6 +453,7 @@ swayc_t *new_floating_view(wlc_handle handle) {
 		handle, wlc_view_get_type(handle), title);
 	// Setup values
 	view->handle = handle;
+	handle_index_insert(handle, view);
 	view->name = title ? strdup(title) : NULL;
 	const char *class = wlc_view_get_class(handle);
 	view->class = class ? strdup(class) : NULL;
@@ -320,6 +482,8 @@ swayc_t *new_floating_view(wlc_handle handle) {
 	if (swayc_active_workspace()->focused == NULL) {
 		set_focused_container_for(swayc_active_workspace(), view);
 	}
+	handle_index_check();
+	ipc_event_window(view, "new");
 	return view;
 }
 
@@ -347,6 +511,7 @@ swayc_t *destroy_output(swayc_t *output) {
 	}
 	sway_log(L_DEBUG, "OUTPUT: Destroying output '%lu'", output->handle);
 	free_swayc(output);
+	handle_index_check();
 	return &root_container;
 }
 
@@ -410,8 +575,10 @@ swayc_t *destroy_view(swayc_t *view) {
 		return NULL;
 	}
 	sway_log(L_DEBUG, "Destroying view '%p'", view);
+	ipc_event_window(view, "close");
 	swayc_t *parent = view->parent;
 	free_swayc(view);
+	handle_index_check();
 
 	// Destroy empty containers
 	if (parent->type == C_CONTAINER) {
@@ -514,7 +681,8 @@ swayc_t *swayc_focus_by_layout(swayc_t *container, enum swayc_layouts layout) {
 	return container;
 }
 
-
+#if SWAY_TREE_CHECKS
+// Reference lookup used to verify the handle index with enable-tree-checks
 static swayc_t *_swayc_by_handle_helper(wlc_handle handle, swayc_t *parent) {
 	if (!parent || !parent->children) {
 		return NULL;
@@ -545,9 +713,15 @@ static swayc_t *_swayc_by_handle_helper(wlc_handle handle, swayc_t *parent) {
 	}
 	return NULL;
 }
+#endif
 
 swayc_t *swayc_by_handle(wlc_handle handle) {
-	return _swayc_by_handle_helper(handle, &root_container);
+	struct handle_entry *entry = handle_index_find(handle);
+	// containers taken out of the tree (scratchpad) are not visible here
+	if (!entry || !entry->cont->parent) {
+		return NULL;
+	}
+	return entry->cont;
 }
 
 swayc_t *swayc_active_output(void) {
@@ -1,6 +1,8 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
 #include <regex.h>
 #include "criteria.h"
 #include "stringop.h"
@@ -33,13 +35,23 @@ static const char * const criteria_strings[] = {
 	"workspace"
 };
 
+// How a token value is tested. Values without any regex special characters
+// don't need regexec, and anchored ones can be looked up by hash.
+enum crit_match {
+	MATCH_REGEX,
+	MATCH_EXACT, // "^literal$"
+	MATCH_SUBSTRING, // "literal"
+};
+
 /**
  * A single criteria token (ie. value/regex pair),
  * e.g. 'class="some class regex"'.
  */
 struct crit_token {
 	enum criteria_type type;
+	enum crit_match match;
 	regex_t *regex;
+	char *literal; // for MATCH_EXACT and MATCH_SUBSTRING
 	char *raw;
 };
 
@@ -48,13 +60,16 @@ static void free_crit_token(struct crit_token *crit) {
 		regfree(crit->regex);
 		free(crit->regex);
 	}
+	if (crit->literal) {
+		free(crit->literal);
+	}
 	if (crit->raw) {
 		free(crit->raw);
 	}
 	free(crit);
 }
 
-static void free_crit_tokens(list_t *crit_tokens) {
+void free_crit_tokens(list_t *crit_tokens) {
 	for (int i = 0; i < crit_tokens->length; i++) {
 		free_crit_token(crit_tokens->items[i]);
 	}
@@ -205,6 +220,22 @@ static char *generate_regex(regex_t **regex, char *value) {
 	return NULL;
 }
 
+// Sets token->match and token->literal if value can be tested without regex.
+static void classify_value(struct crit_token *token, const char *value) {
+	size_t len = strlen(value);
+	bool anchor_start = len > 0 && value[0] == '^';
+	bool anchor_end = len > (size_t)anchor_start && value[len - 1] == '$';
+	const char *start = value + anchor_start;
+	size_t literal_len = len - anchor_start - anchor_end;
+	// A superset of the basic and extended regex special characters.
+	if (strcspn(start, ".[]()*+?{}|\\^$") < literal_len) {
+		token->match = MATCH_REGEX;
+		return;
+	}
+	token->literal = strndup(start, literal_len);
+	token->match = anchor_start && anchor_end ? MATCH_EXACT : MATCH_SUBSTRING;
+}
+
 // Pouplate list with crit_tokens extracted from criteria string, returns error
 // string or NULL if successful.
 char *extract_crit_tokens(list_t *tokens, const char * const criteria) {
@@ -224,6 +255,10 @@ char *extract_crit_tokens(list_t *tokens, const char * const criteria) {
 		} else if (token->type == CRIT_URGENT || strcmp(value, "focused") == 0) {
 			sway_log(L_DEBUG, "%s -> \"%s\"", name, value);
 			list_add(tokens, token);
+		} else if (classify_value(token, value), token->match != MATCH_REGEX) {
+			sway_log(L_DEBUG, "%s -> %s \"%s\"", name,
+				token->match == MATCH_EXACT ? "exactly" : "containing", token->literal);
+			list_add(tokens, token);
 		} else if((error = generate_regex(&token->regex, value))) {
 			free_crit_token(token);
 			goto ect_cleanup;
@@ -238,6 +273,18 @@ ect_cleanup:
 	return error;
 }
 
+static bool token_matches(struct crit_token *crit, const char *value) {
+	switch (crit->match) {
+	case MATCH_EXACT:
+		return strcmp(crit->literal, value) == 0;
+	case MATCH_SUBSTRING:
+		return strstr(value, crit->literal) != NULL;
+	case MATCH_REGEX:
+		return crit->regex && regexec(crit->regex, value, 0, NULL, 0) == 0;
+	}
+	return false;
+}
+
 // test a single view if it matches list of criteria tokens (all of them).
 static bool criteria_test(swayc_t *cont, list_t *tokens) {
 	if (cont->type != C_VIEW) {
@@ -255,14 +302,14 @@ static bool criteria_test(swayc_t *cont, list_t *tokens) {
 				if (focused->class && strcmp(cont->class, focused->class) == 0) {
 					matches++;
 				}
-			} else if (crit->regex && regexec(crit->regex, cont->class, 0, NULL, 0) == 0) {
+			} else if (token_matches(crit, cont->class)) {
 				matches++;
 			}
 			break;
 		case CRIT_ID:
 			if (!cont->app_id) {
 				// ignore
-			} else if (crit->regex && regexec(crit->regex, cont->app_id, 0, NULL, 0) == 0) {
+			} else if (token_matches(crit, cont->app_id)) {
 				matches++;
 			}
 			break;
@@ -276,7 +323,7 @@ static bool criteria_test(swayc_t *cont, list_t *tokens) {
 				if (focused->name && strcmp(cont->name, focused->name) == 0) {
 					matches++;
 				}
-			} else if (crit->regex && regexec(crit->regex, cont->name, 0, NULL, 0) == 0) {
+			} else if (token_matches(crit, cont->name)) {
 				matches++;
 			}
 			break;
@@ -296,7 +343,7 @@ static bool criteria_test(swayc_t *cont, list_t *tokens) {
 				if (focused_ws->name && strcmp(cont_ws->name, focused_ws->name) == 0) {
 					matches++;
 				}
-			} else if (crit->regex && regexec(crit->regex, cont_ws->name, 0, NULL, 0) == 0) {
+			} else if (token_matches(crit, cont_ws->name)) {
 				matches++;
 			}
 			break;
@@ -337,13 +384,177 @@ void free_criteria(struct criteria *crit) {
 	free(crit);
 }
 
+/**
+ * Criteria with a token that must equal a literal are hashed by that token,
+ * so a view only has to be tested against the criteria in its own buckets
+ * plus the ones without such a token.
+ */
+struct crit_bucket {
+	enum criteria_type type;
+	const char *key;
+	list_t *criteria; // indices into config->criteria, ascending
+	struct crit_bucket *next;
+};
+
+struct criteria_index {
+	int length; // of config->criteria when built
+	int capacity;
+	struct crit_bucket **buckets;
+	list_t *rest; // indices of criteria without an exact token, ascending
+};
+
+static uint32_t crit_hash(enum criteria_type type, const char *key) {
+	// FNV-1a
+	uint32_t hash = 2166136261u ^ (uint32_t)type;
+	for (; *key; ++key) {
+		hash ^= (unsigned char)*key;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static struct crit_bucket *index_bucket(struct criteria_index *index,
+		enum criteria_type type, const char *key, bool create) {
+	struct crit_bucket **slot = &index->buckets[crit_hash(type, key) & (index->capacity - 1)];
+	for (struct crit_bucket *b = *slot; b; b = b->next) {
+		if (b->type == type && strcmp(b->key, key) == 0) {
+			return b;
+		}
+	}
+	if (!create) {
+		return NULL;
+	}
+	struct crit_bucket *b = malloc(sizeof(struct crit_bucket));
+	b->type = type;
+	b->key = key;
+	b->criteria = create_list();
+	b->next = *slot;
+	*slot = b;
+	return b;
+}
+
+// Only the view properties criteria_test compares by value can be keys.
+static struct crit_token *index_key(struct criteria *crit) {
+	for (int i = 0; i < crit->tokens->length; i++) {
+		struct crit_token *token = crit->tokens->items[i];
+		if (token->match == MATCH_EXACT && (token->type == CRIT_CLASS
+				|| token->type == CRIT_ID || token->type == CRIT_TITLE
+				|| token->type == CRIT_WORKSPACE)) {
+			return token;
+		}
+	}
+	return NULL;
+}
+
+void free_criteria_index(struct criteria_index *index) {
+	if (!index) {
+		return;
+	}
+	for (int i = 0; i < index->capacity; i++) {
+		struct crit_bucket *b = index->buckets[i];
+		while (b) {
+			struct crit_bucket *next = b->next;
+			list_free(b->criteria);
+			free(b);
+			b = next;
+		}
+	}
+	free(index->buckets);
+	list_free(index->rest);
+	free(index);
+}
+
+static struct criteria_index *build_criteria_index(list_t *criteria) {
+	struct criteria_index *index = calloc(1, sizeof(struct criteria_index));
+	index->length = criteria->length;
+	index->capacity = 16;
+	while (index->capacity < criteria->length * 2) {
+		index->capacity *= 2;
+	}
+	index->buckets = calloc(index->capacity, sizeof(struct crit_bucket *));
+	index->rest = create_list();
+	for (int i = 0; i < criteria->length; i++) {
+		struct crit_token *key = index_key(criteria->items[i]);
+		if (key) {
+			struct crit_bucket *b = index_bucket(index, key->type, key->literal, true);
+			list_add(b->criteria, (void *)(intptr_t)i);
+		} else {
+			list_add(index->rest, (void *)(intptr_t)i);
+		}
+	}
+	sway_log(L_DEBUG, "Indexed %d criteria, %d need a full scan",
+			criteria->length, index->rest->length);
+	return index;
+}
+
+// Criteria are only ever appended to config->criteria, so a changed length
+// means the index is stale.
+static struct criteria_index *criteria_index(void) {
+	if (config->criteria_index && config->criteria_index->length != config->criteria->length) {
+		free_criteria_index(config->criteria_index);
+		config->criteria_index = NULL;
+	}
+	if (!config->criteria_index) {
+		config->criteria_index = build_criteria_index(config->criteria);
+	}
+	return config->criteria_index;
+}
+
+static void add_candidates(list_t *candidates, struct criteria_index *index,
+		enum criteria_type type, const char *value) {
+	if (!value) {
+		return;
+	}
+	struct crit_bucket *b = index_bucket(index, type, value, false);
+	if (b) {
+		list_cat(candidates, b->criteria);
+	}
+}
+
+static int index_entry_cmp(const void *a, const void *b) {
+	intptr_t x = (intptr_t)*(void * const *)a, y = (intptr_t)*(void * const *)b;
+	return (x > y) - (x < y);
+}
+
 list_t *criteria_for(swayc_t *cont) {
 	list_t *criteria = config->criteria, *matches = create_list();
-	for (int i = 0; i < criteria->length; i++) {
-		struct criteria *bc = criteria->items[i];
+	if (cont->type != C_VIEW) {
+		return matches;
+	}
+	struct criteria_index *index = criteria_index();
+	list_t *candidates = create_list();
+	add_candidates(candidates, index, CRIT_CLASS, cont->class);
+	add_candidates(candidates, index, CRIT_ID, cont->app_id);
+	add_candidates(candidates, index, CRIT_TITLE, cont->name);
+	swayc_t *ws = swayc_parent_by_type(cont, C_WORKSPACE);
+	add_candidates(candidates, index, CRIT_WORKSPACE, ws ? ws->name : NULL);
+	list_cat(candidates, index->rest);
+	// keep the order the criteria were configured in
+	list_qsort(candidates, index_entry_cmp);
+	for (int i = 0; i < candidates->length; i++) {
+		struct criteria *bc = criteria->items[(intptr_t)candidates->items[i]];
 		if (criteria_test(cont, bc->tokens)) {
 			list_add(matches, bc);
 		}
 	}
+	list_free(candidates);
 	return matches;
 }
+
+struct match_args {
+	list_t *tokens;
+	list_t *matches;
+};
+
+static void container_match_add(swayc_t *container, void *data) {
+	struct match_args *args = data;
+	if (criteria_test(container, args->tokens)) {
+		list_add(args->matches, container);
+	}
+}
+
+list_t *container_for(list_t *tokens) {
+	struct match_args args = { tokens, create_list() };
+	container_map(&root_container, container_match_add, &args);
+	return args.matches;
+}
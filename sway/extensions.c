@@ -24,6 +24,54 @@ static struct panel_config *find_or_create_panel_config(struct wl_resource *reso
 	return config;
 }
 
+static swayc_t *shell_output(wlc_handle handle) {
+	swayc_t *output = swayc_by_handle(handle);
+	if (output && output->type == C_OUTPUT) {
+		return output;
+	}
+	return NULL;
+}
+
+// The first background set for an output is the one drawn, fall back to the
+// next oldest when it goes away.
+static void update_background_slot(swayc_t *output) {
+	output->background = NULL;
+	int i;
+	for (i = 0; i < desktop_shell.backgrounds->length; ++i) {
+		struct background_config *config = desktop_shell.backgrounds->items[i];
+		if (config->output == output->handle) {
+			output->background = config;
+			break;
+		}
+	}
+}
+
+static void remove_panel_slot(struct panel_config *config) {
+	swayc_t *output = shell_output(config->output);
+	if (!output) {
+		return;
+	}
+	int i;
+	for (i = 0; i < output->panels->length; ++i) {
+		if (output->panels->items[i] == config) {
+			list_del(output->panels, i);
+			break;
+		}
+	}
+	layout_mark_dirty(output);
+}
+
+void desktop_shell_add_output(swayc_t *output) {
+	update_background_slot(output);
+	int i;
+	for (i = 0; i < desktop_shell.panels->length; ++i) {
+		struct panel_config *config = desktop_shell.panels->items[i];
+		if (config->surface && config->output == output->handle) {
+			list_add(output->panels, config);
+		}
+	}
+}
+
 void background_surface_destructor(struct wl_resource *resource) {
 	sway_log(L_DEBUG, "Background surface killed");
 	int i;
@@ -31,6 +79,11 @@ void background_surface_destructor(struct wl_resource *resource) {
 		struct background_config *config = desktop_shell.backgrounds->items[i];
 		if (config->wl_surface_res == resource) {
 			list_del(desktop_shell.backgrounds, i);
+			swayc_t *output = shell_output(config->output);
+			if (output && output->background == config) {
+				update_background_slot(output);
+			}
+			free(config);
 			break;
 		}
 	}
@@ -43,7 +96,9 @@ void panel_surface_destructor(struct wl_resource *resource) {
 		struct panel_config *config = desktop_shell.panels->items[i];
 		if (config->wl_surface_res == resource) {
 			list_del(desktop_shell.panels, i);
-			arrange_windows(&root_container, -1, -1);
+			remove_panel_slot(config);
+			arrange_dirty_windows();
+			free(config);
 			break;
 		}
 	}
@@ -56,7 +111,8 @@ void lock_surface_destructor(struct wl_resource *resource) {
 		struct wl_resource *surface = desktop_shell.lock_surfaces->items[i];
 		if (surface == resource) {
 			list_del(desktop_shell.lock_surfaces, i);
-			arrange_windows(&root_container, -1, -1);
+			// the lock view itself is rearranged when it gets destroyed
+			arrange_dirty_windows();
 			desktop_shell.is_locked = false;
 			break;
 		}
@@ -76,6 +132,10 @@ static void set_background(struct wl_client *client, struct wl_resource *resourc
 	config->wl_surface_res = surface;
 	list_add(desktop_shell.backgrounds, config);
 	wl_resource_set_destructor(surface, background_surface_destructor);
+	swayc_t *op = shell_output(output);
+	if (op && !op->background) {
+		op->background = config;
+	}
 }
 
 static void set_panel(struct wl_client *client, struct wl_resource *resource,
@@ -86,12 +146,20 @@ static void set_panel(struct wl_client *client, struct wl_resource *resource,
 	}
 	sway_log(L_DEBUG, "Setting surface %p as panel for output %d (wl_resource: %p)", surface, (int)output, resource);
 	struct panel_config *config = find_or_create_panel_config(resource);
+	if (config->surface) {
+		remove_panel_slot(config);
+	}
 	config->output = output;
 	config->surface = wlc_resource_from_wl_surface_resource(surface);
 	config->wl_surface_res = surface;
 	wl_resource_set_destructor(surface, panel_surface_destructor);
-	desktop_shell.panel_size = *wlc_surface_get_size(config->surface);
-	arrange_windows(&root_container, -1, -1);
+	config->size = *wlc_surface_get_size(config->surface);
+	swayc_t *op = shell_output(output);
+	if (op) {
+		list_add(op->panels, config);
+		layout_mark_dirty(op);
+	}
+	arrange_dirty_windows();
 }
 
 static void desktop_set_lock_surface(struct wl_client *client, struct wl_resource *resource, struct wl_resource *surface) {
@@ -138,7 +206,8 @@ static void set_panel_position(struct wl_client *client, struct wl_resource *res
 	struct panel_config *config = find_or_create_panel_config(resource);
 	sway_log(L_DEBUG, "Panel position for wl_resource %p changed %d => %d", resource, config->panel_position, position);
 	config->panel_position = position;
-	arrange_windows(&root_container, -1, -1);
+	layout_mark_dirty(swayc_by_handle(config->output));
+	arrange_dirty_windows();
 }
 
 static struct desktop_shell_interface desktop_shell_implementation = {
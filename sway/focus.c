@@ -7,6 +7,7 @@
 #include "config.h"
 #include "input_state.h"
 #include "ipc-server.h"
+#include "frame_timing.h"
 
 bool locked_container_focus = false;
 bool locked_view_focus = false;
@@ -130,15 +131,20 @@ bool set_focused_container(swayc_t *c) {
 		// unactivate previous focus
 		if (focused->type == C_VIEW) {
 			wlc_view_set_state(focused->handle, WLC_BIT_ACTIVATED, false);
+			frame_timing_damage(swayc_parent_by_type(focused, C_OUTPUT)->frame_timing);
 		}
 		// activate current focus
 		if (p->type == C_VIEW) {
 			wlc_view_set_state(p->handle, WLC_BIT_ACTIVATED, true);
+			frame_timing_damage(swayc_parent_by_type(p, C_OUTPUT)->frame_timing);
 			// set focus if view_focus is unlocked
 			if (!locked_view_focus) {
 				wlc_view_focus(p->handle);
 			}
 		}
+		if (p != focused) {
+			ipc_event_window(p, "focus");
+		}
 	}
 
 	if (active_ws != workspace) {
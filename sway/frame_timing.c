@@ -0,0 +1,133 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "frame_timing.h"
+
+// wlc does not tell us the refresh rate, and only renders on damage. The
+// shortest of the recent intervals between damaged frames stands in for the
+// refresh period, and gaps longer than FRAME_IDLE_NS are the output sitting idle rather than
+// a stutter.
+#define FRAME_IDLE_NS 100000000u
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static uint32_t clamp_u32(uint64_t v) {
+	return v > UINT32_MAX ? UINT32_MAX : (uint32_t)v;
+}
+
+struct frame_timing *frame_timing_create(void) {
+	return calloc(1, sizeof(struct frame_timing));
+}
+
+void frame_timing_destroy(struct frame_timing *timing) {
+	free(timing);
+}
+
+void frame_timing_damage(struct frame_timing *timing) {
+	if (!timing->damage) {
+		timing->damage = now_ns();
+	}
+}
+
+void frame_timing_reset_period(struct frame_timing *timing) {
+	timing->period = 0;
+	timing->period_head = timing->period_length = 0;
+	// the interval up to the next frame straddles the change
+	timing->last_start = 0;
+}
+
+// Only recent intervals count, so one short interval (two frames wlc
+// happened to render back to back) doesn't stick forever.
+static void update_period(struct frame_timing *timing, uint32_t interval) {
+	int i;
+	timing->period_interval[timing->period_head] = interval;
+	timing->period_head = (timing->period_head + 1) % FRAME_PERIOD_SAMPLES;
+	if (timing->period_length < FRAME_PERIOD_SAMPLES) {
+		++timing->period_length;
+	}
+	timing->period = timing->period_interval[0];
+	for (i = 1; i < timing->period_length; ++i) {
+		if (timing->period_interval[i] < timing->period) {
+			timing->period = timing->period_interval[i];
+		}
+	}
+}
+
+void frame_timing_begin(struct frame_timing *timing) {
+	timing->current_start = now_ns();
+	// damage reported while this frame is prepared is for the next one
+	timing->current_damage = timing->damage;
+	timing->damage = 0;
+}
+
+void frame_timing_end(struct frame_timing *timing) {
+	uint64_t end = now_ns();
+	uint32_t interval = 0;
+	if (timing->last_start) {
+		interval = clamp_u32(timing->current_start - timing->last_start);
+	}
+	if (!interval || interval > FRAME_IDLE_NS) {
+		// first frame after idling, don't let the gap skew the stats
+		interval = 0;
+	} else if (timing->current_damage) {
+		// A frame is late if it came more than half a period after it could
+		// have: a period after the previous one, or after the damage if that
+		// came later.
+		uint64_t since = timing->current_damage > timing->last_start ?
+			timing->current_damage : timing->last_start;
+		uint32_t latency = clamp_u32(timing->current_start - since);
+		if (timing->period && latency > timing->period + timing->period / 2) {
+			++timing->missed;
+		}
+		update_period(timing, interval);
+	}
+	timing->interval[timing->head] = interval;
+	timing->pre_render[timing->head] = clamp_u32(end - timing->current_start);
+	timing->head = (timing->head + 1) % FRAME_TIMING_SAMPLES;
+	if (timing->length < FRAME_TIMING_SAMPLES) {
+		++timing->length;
+	}
+	timing->last_start = timing->current_start;
+	++timing->frames;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+// Percentiles of the non-zero samples, in microseconds.
+static json_object *percentiles_json(const uint32_t *samples, int length) {
+	uint32_t sorted[FRAME_TIMING_SAMPLES];
+	int i, n = 0;
+	for (i = 0; i < length; ++i) {
+		if (samples[i]) {
+			sorted[n++] = samples[i];
+		}
+	}
+	json_object *json = json_object_new_object();
+	if (n == 0) {
+		json_object_object_add(json, "p50", json_object_new_int(0));
+		json_object_object_add(json, "p99", json_object_new_int(0));
+		json_object_object_add(json, "max", json_object_new_int(0));
+		return json;
+	}
+	qsort(sorted, n, sizeof(uint32_t), cmp_u32);
+	json_object_object_add(json, "p50", json_object_new_int(sorted[(n - 1) * 50 / 100] / 1000));
+	json_object_object_add(json, "p99", json_object_new_int(sorted[(n - 1) * 99 / 100] / 1000));
+	json_object_object_add(json, "max", json_object_new_int(sorted[n - 1] / 1000));
+	return json;
+}
+
+json_object *frame_timing_json(const struct frame_timing *timing) {
+	json_object *json = json_object_new_object();
+	json_object_object_add(json, "frames", json_object_new_int64(timing->frames));
+	json_object_object_add(json, "missed", json_object_new_int64(timing->missed));
+	json_object_object_add(json, "frame_time", percentiles_json(timing->interval, timing->length));
+	json_object_object_add(json, "pre_render", percentiles_json(timing->pre_render, timing->length));
+	return json;
+}
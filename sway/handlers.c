@@ -22,8 +22,10 @@
 #include "extensions.h"
 #include "criteria.h"
 #include "ipc-server.h"
+#include "ipc-state.h"
 #include "list.h"
 #include "input.h"
+#include "frame_timing.h"
 
 // Event should be sent to client
 #define EVENT_PASSTHROUGH false
@@ -73,6 +75,7 @@ static bool handle_output_created(wlc_handle output) {
 	if (!op) {
 		return false;
 	}
+	ipc_state_changed();
 
 	// Switch to workspace if we need to
 	if (swayc_active_workspace() == NULL) {
@@ -97,6 +100,7 @@ static void handle_output_destroyed(wlc_handle output) {
 	}
 	if (i < list->length) {
 		destroy_output(list->items[i]);
+		ipc_state_changed();
 	} else {
 		return;
 	}
@@ -106,47 +110,68 @@ static void handle_output_destroyed(wlc_handle output) {
 	}
 }
 
+// wlc doesn't tell us when a title changes, compare them every frame. The
+// title is kept current even with no one listening, criteria match on it.
+static void update_view_title(swayc_t *view, void *data) {
+	if (view->type != C_VIEW) {
+		return;
+	}
+	const char *title = wlc_view_get_title(view->handle);
+	if (title == view->name || (title && view->name && strcmp(title, view->name) == 0)) {
+		return;
+	}
+	free(view->name);
+	view->name = title ? strdup(title) : NULL;
+	ipc_event_window(view, "title");
+}
+
 static void handle_output_pre_render(wlc_handle output) {
+	swayc_t *c = swayc_by_handle(output);
+	if (!c) {
+		return;
+	}
+	frame_timing_begin(c->frame_timing);
+	// all of the output's workspaces, a hidden view's title can change too,
+	// and before the flush, so the events go out with this frame
+	container_map(c, update_view_title, NULL);
+	ipc_event_flush();
 	struct wlc_size resolution = *wlc_output_get_resolution(output);
 
-	int i;
-	for (i = 0; i < desktop_shell.backgrounds->length; ++i) {
-		struct background_config *config = desktop_shell.backgrounds->items[i];
-		if (config->output == output) {
-			wlc_surface_render(config->surface, &(struct wlc_geometry){ wlc_origin_zero, resolution });
-			break;
-		}
+	if (c->background) {
+		wlc_surface_render(c->background->surface, &(struct wlc_geometry){ wlc_origin_zero, resolution });
 	}
 
-	for (i = 0; i < desktop_shell.panels->length; ++i) {
-		struct panel_config *config = desktop_shell.panels->items[i];
-		if (config->output == output) {
-			struct wlc_size size = *wlc_surface_get_size(config->surface);
-			struct wlc_geometry geo = {
-				.size = size
-			};
-			switch (config->panel_position) {
-			case DESKTOP_SHELL_PANEL_POSITION_TOP:
-				geo.origin = (struct wlc_point){ 0, 0 };
-				break;
-			case DESKTOP_SHELL_PANEL_POSITION_BOTTOM:
-				geo.origin = (struct wlc_point){ 0, resolution.h - size.h };
-				break;
-			case DESKTOP_SHELL_PANEL_POSITION_LEFT:
-				geo.origin = (struct wlc_point){ 0, 0 };
-				break;
-			case DESKTOP_SHELL_PANEL_POSITION_RIGHT:
-				geo.origin = (struct wlc_point){ resolution.w - size.w, 0 };
-				break;
-			}
-			wlc_surface_render(config->surface, &geo);
-			if (size.w != desktop_shell.panel_size.w || size.h != desktop_shell.panel_size.h) {
-				desktop_shell.panel_size = size;
-				arrange_windows(&root_container, -1, -1);
-			}
+	int i;
+	for (i = 0; i < c->panels->length; ++i) {
+		struct panel_config *config = c->panels->items[i];
+		struct wlc_size size = *wlc_surface_get_size(config->surface);
+		struct wlc_geometry geo = {
+			.size = size
+		};
+		switch (config->panel_position) {
+		case DESKTOP_SHELL_PANEL_POSITION_TOP:
+			geo.origin = (struct wlc_point){ 0, 0 };
+			break;
+		case DESKTOP_SHELL_PANEL_POSITION_BOTTOM:
+			geo.origin = (struct wlc_point){ 0, resolution.h - size.h };
+			break;
+		case DESKTOP_SHELL_PANEL_POSITION_LEFT:
+			geo.origin = (struct wlc_point){ 0, 0 };
 			break;
+		case DESKTOP_SHELL_PANEL_POSITION_RIGHT:
+			geo.origin = (struct wlc_point){ resolution.w - size.w, 0 };
+			break;
+		}
+		wlc_surface_render(config->surface, &geo);
+		if (size.w != config->size.w || size.h != config->size.h) {
+			config->size = size;
+			// only the workspaces of this output lose space to the panel
+			layout_mark_dirty(c);
+			arrange_dirty_windows();
 		}
 	}
+
+	frame_timing_end(c->frame_timing);
 }
 
 static void handle_output_resolution_change(wlc_handle output, const struct wlc_size *from, const struct wlc_size *to) {
@@ -155,7 +180,9 @@ static void handle_output_resolution_change(wlc_handle output, const struct wlc_
 	if (!c) return;
 	c->width = to->w;
 	c->height = to->h;
-	arrange_windows(&root_container, -1, -1);
+	// a new mode likely comes with a different refresh rate
+	frame_timing_reset_period(c->frame_timing);
+	arrange_windows(c, -1, -1);
 }
 
 static void handle_output_focused(wlc_handle output, bool focus) {
@@ -238,8 +265,10 @@ static bool handle_view_created(wlc_handle handle) {
 
 	if (newview) {
 		set_focused_container(newview);
-		swayc_t *output = swayc_parent_by_type(newview, C_OUTPUT);
-		arrange_windows(output, -1, -1);
+		// only the workspace the view went to changes, other workspaces and
+		// outputs stay untouched
+		layout_mark_dirty(swayc_parent_by_type(newview, C_WORKSPACE));
+		arrange_dirty_windows();
 		// check if it matches for_window in config and execute if so
 		list_t *criteria = criteria_for(newview);
 		for (int i = 0; i < criteria->length; i++) {
@@ -338,7 +367,8 @@ static void handle_view_geometry_request(wlc_handle handle, const struct wlc_geo
 			view->height = view->desired_height;
 			view->x = geometry->origin.x;
 			view->y = geometry->origin.y;
-			arrange_windows(view->parent, -1, -1);
+			layout_mark_dirty(view);
+			arrange_dirty_windows();
 		}
 	}
 }
@@ -8,13 +8,21 @@
 #include <wlc/wlc.h>
 #include <unistd.h>
 #include <stdlib.h>
-#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <ctype.h>
+#include <inttypes.h>
+#include <fnmatch.h>
+#include <time.h>
 #include <json-c/json.h>
 #include <list.h>
 #include <libinput.h>
 #include "ipc-server.h"
+#include "ipc-state.h"
+#include "ipc-client.h"
+#include "cbor.h"
+#include "readline.h"
 #include "log.h"
 #include "config.h"
 #include "commands.h"
@@ -22,32 +30,303 @@
 #include "stringop.h"
 #include "util.h"
 #include "input.h"
+#include "layout.h"
+#include "frame_timing.h"
 
 static int ipc_socket = -1;
 static struct wlc_event_source *ipc_event_source =  NULL;
 static struct sockaddr_un *ipc_sockaddr = NULL;
 static list_t *ipc_client_list = NULL;
+// events waiting for the next frame, for clients that didn't ask for exact
+// event streams
+static list_t *pending_events = NULL;
+static struct wlc_event_source *event_flush_timer = NULL;
+// handles the requests of clients whose capture is done
+static struct wlc_event_source *capture_resume_timer = NULL;
+// connected clients with state_shm set
+static int state_shm_clients = 0;
+// struct pixels_capture of frames requested from wlc but not rendered yet
+static list_t *pixels_captures = NULL;
+// Shared by all CBOR clients, a payload is only needed until it's queued.
+static struct cbor_buffer cbor_payload;
+// A window event with the seq of the client it goes to.
+static char *window_event_buffer = NULL;
+static size_t window_event_size = 0;
 
 static const char ipc_magic[] = {'i', '3', '-', 'i', 'p', 'c'};
 
+// Event types all share the high bit, so they can't be or'ed into a mask as
+// they are.
+static inline uint32_t ipc_event_mask(enum ipc_command_type event) {
+	return 1u << (event & 0x1f);
+}
+
+// Which part of a frame a GET_PIXELS(_SHM) request wants and how.
+struct pixels_request {
+	// in output coordinates, an empty region is the whole output
+	struct wlc_geometry region;
+	// downscale by this factor, averaging scale x scale blocks
+	uint32_t scale;
+	bool top_down;
+	// GET_PIXELS_SHM only, update just the changed tiles of the last frame
+	bool delta;
+};
+
+// What an event is about, checked against subscription filters before the
+// event is sent. Unset fields match any filter.
+struct ipc_event_attrs {
+	const char *change;
+	// e.g. the old and new workspace of a focus change
+	const char *output[2];
+	const char *workspace[2];
+};
+
+// A subscription to only some events of a type. Set fields must all match.
+struct ipc_event_filter {
+	enum ipc_command_type event;
+	char *output;
+	// fnmatch pattern
+	char *workspace;
+	// accepted change values, NULL for any
+	list_t *changes;
+};
+
+static void free_event_filter(void *item) {
+	struct ipc_event_filter *filter = item;
+	free(filter->output);
+	free(filter->workspace);
+	if (filter->changes) {
+		free_flat_list(filter->changes);
+	}
+	free(filter);
+}
+
+// A frame requested from wlc for a client. wlc only hands it back once the
+// output renders, the client may have disconnected by then.
+struct pixels_capture {
+	// NULL once the client is gone
+	struct ipc_client *client;
+	// copied, the client may send more requests before the frame comes
+	struct pixels_request request;
+	enum ipc_command_type type;
+};
+
 struct ipc_client {
 	struct wlc_event_source *event_source;
+	// only present while there is outgoing data the socket didn't take yet
+	struct wlc_event_source *writable_event_source;
 	int fd;
 	uint32_t payload_length;
 	enum ipc_command_type current_command;
-	enum ipc_command_type subscribed_events;
+	// bit (event & 0x1f) is set for every subscribed event type
+	uint32_t subscribed_events;
+	// event types subscribed to without a filter, the others are only sent
+	// if one of event_filters matches
+	uint32_t unfiltered_events;
+	list_t *event_filters;
+	// ring buffer of outgoing data, write_len bytes starting at write_start
+	char *write_buffer;
+	size_t write_size, write_start, write_len;
+	// incoming data not yet handled, starts at a message header
+	char *read_buffer;
+	size_t read_size, read_len;
+	// set while handling messages, a disconnect then only frees the client
+	// once they're done
+	bool dispatching;
+	// a GET_PIXELS(_SHM) reply waits for the next frame. Later requests
+	// wait for it too, so replies go out in the order of the requests, and
+	// the socket isn't watched (event_source is NULL) meanwhile.
+	bool capture_pending;
+	bool disconnected;
+	// events are sent as they happen instead of merged once per frame
+	bool exact_events;
+	// window events sent to this client so far, their seq
+	uint64_t window_seq;
+	// of the replies and events that are JSON by default
+	enum ipc_encoding encoding;
+	// shared buffer GET_PIXELS_SHM copies frames into, reused while the
+	// frame size stays the same
+	int shm_fd;
+	void *shm_data;
+	size_t shm_size;
+	// fd to pass along with the byte send_fd_offset bytes into the queue, -1
+	// for none
+	int send_fd;
+	size_t send_fd_offset;
+	// was sent the shared state region, which is kept up to date while any
+	// such client is connected
+	bool state_shm;
+	// for GET_IPC_STATS, pid is 0 if the peer is unknown
+	pid_t pid;
+	uint64_t messages, bytes_in, bytes_out;
+	size_t max_queued;
 };
 
+static struct {
+	uint64_t queued_bytes; // currently waiting in client buffers
+	uint64_t total_queued_bytes;
+	uint64_t stalls; // replies the socket didn't take in full
+	uint64_t dropped_events;
+	uint64_t disconnected_clients;
+} ipc_write_stats;
+
+enum ipc_disconnect_reason {
+	IPC_DISCONNECT_CLOSED,
+	IPC_DISCONNECT_ERROR,
+	IPC_DISCONNECT_BAD_MESSAGE,
+	IPC_DISCONNECT_NOT_READING,
+	IPC_DISCONNECT_REASONS,
+};
+
+static const char *ipc_disconnect_reason_names[IPC_DISCONNECT_REASONS] = {
+	"closed", "error", "bad_message", "not_reading",
+};
+
+// Bucket i counts handlers that took less than 2^i microseconds, the last
+// one everything slower.
+#define IPC_LATENCY_BUCKETS 20
+// i3 message types, sway's from 0x80 and events, 16 each
+#define IPC_STATS_SLOTS 48
+
+struct ipc_message_stats {
+	// requests handled, or events sent to a client
+	uint64_t count;
+	// bytes_out is the replies to requests of this type, or the events
+	uint64_t bytes_in, bytes_out;
+	// time spent in the request handler
+	uint64_t latency[IPC_LATENCY_BUCKETS];
+	uint64_t latency_total_ns, latency_max_ns;
+};
+
+static struct {
+	struct ipc_message_stats messages[IPC_STATS_SLOTS];
+	uint64_t disconnects[IPC_DISCONNECT_REASONS];
+} ipc_stats;
+
+static struct ipc_message_stats *ipc_message_stats(enum ipc_command_type type) {
+	uint32_t t = type;
+	if (t >> 31) {
+		t &= ~(1u << 31);
+		return t < 16 ? &ipc_stats.messages[32 + t] : NULL;
+	} else if (t >= 0x80) {
+		return t < 0x90 ? &ipc_stats.messages[16 + t - 0x80] : NULL;
+	}
+	return t < 16 ? &ipc_stats.messages[t] : NULL;
+}
+
+static const char *ipc_message_name(enum ipc_command_type type) {
+	switch (type) {
+	case IPC_COMMAND: return "command";
+	case IPC_GET_WORKSPACES: return "get_workspaces";
+	case IPC_SUBSCRIBE: return "subscribe";
+	case IPC_GET_OUTPUTS: return "get_outputs";
+	case IPC_GET_TREE: return "get_tree";
+	case IPC_GET_MARKS: return "get_marks";
+	case IPC_GET_BAR_CONFIG: return "get_bar_config";
+	case IPC_GET_VERSION: return "get_version";
+	case IPC_GET_INPUTS: return "get_inputs";
+	case IPC_EVENT_WORKSPACE: return "workspace";
+	case IPC_EVENT_OUTPUT: return "output";
+	case IPC_EVENT_MODE: return "mode";
+	case IPC_EVENT_WINDOW: return "window";
+	case IPC_EVENT_BARCONFIG_UPDATE: return "barconfig_update";
+	case IPC_EVENT_BINDING: return "binding";
+	case IPC_EVENT_MODIFIER: return "modifier";
+	case IPC_EVENT_INPUT: return "input";
+	case IPC_SWAY_GET_PIXELS: return "get_pixels";
+	case IPC_SWAY_GET_GEOMETRY_STATS: return "get_geometry_stats";
+	case IPC_SWAY_GET_FRAME_STATS: return "get_frame_stats";
+	case IPC_SWAY_COMMAND_BATCH: return "command_batch";
+	case IPC_SWAY_GET_IPC_STATS: return "get_ipc_stats";
+	case IPC_SWAY_GET_PIXELS_SHM: return "get_pixels_shm";
+	case IPC_SWAY_GET_STATE_SHM: return "get_state_shm";
+	case IPC_SWAY_SET_ENCODING: return "set_encoding";
+	}
+	return NULL;
+}
+
+static uint64_t ipc_now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void ipc_stats_latency(struct ipc_message_stats *stats, uint64_t ns) {
+	uint64_t us = ns / 1000;
+	int bucket = 0;
+	while (bucket < IPC_LATENCY_BUCKETS - 1 && us >= (1u << bucket)) {
+		++bucket;
+	}
+	++stats->latency[bucket];
+	stats->latency_total_ns += ns;
+	if (ns > stats->latency_max_ns) {
+		stats->latency_max_ns = ns;
+	}
+}
+
 struct sockaddr_un *ipc_user_sockaddr(void);
 int ipc_handle_connection(int fd, uint32_t mask, void *data);
 int ipc_client_handle_readable(int client_fd, uint32_t mask, void *data);
-void ipc_client_disconnect(struct ipc_client *client);
-void ipc_client_handle_command(struct ipc_client *client);
+int ipc_client_handle_writable(int client_fd, uint32_t mask, void *data);
+int ipc_event_flush_timer(void *data);
+int ipc_capture_resume_timer(void *data);
+void ipc_client_disconnect(struct ipc_client *client, enum ipc_disconnect_reason reason);
+void ipc_client_handle_command(struct ipc_client *client, char *buf);
 bool ipc_send_reply(struct ipc_client *client, const char *payload, uint32_t payload_length);
+static bool ipc_send_payload(struct ipc_client *client, enum ipc_command_type type,
+		const char *payload, uint32_t payload_length);
+void ipc_send_event(const char *json_string, enum ipc_command_type event, const char *key,
+		const struct ipc_event_attrs *attrs);
 void ipc_get_workspaces_callback(swayc_t *workspace, void *data);
 void ipc_get_outputs_callback(swayc_t *container, void *data);
 json_object *ipc_json_describe_bar_config(struct bar_config *bar);
 
+// Lets clients without $SWAYSOCK find the socket without running
+// `sway --get-socketpath`.
+static void ipc_write_socketpath_file(void) {
+	char *path = ipc_socketpath_file();
+	if (!path) {
+		return;
+	}
+	char *tmp = malloc(strlen(path) + 5);
+	sprintf(tmp, "%s.tmp", path);
+	// left over if an earlier sway died while writing it
+	unlink(tmp);
+	int fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+	FILE *f = fd == -1 ? NULL : fdopen(fd, "w");
+	if (!f) {
+		sway_log_errno(L_INFO, "Unable to write %s", tmp);
+		if (fd != -1) {
+			close(fd);
+			unlink(tmp);
+		}
+	} else {
+		fprintf(f, "%s\n", ipc_sockaddr->sun_path);
+		fclose(f);
+		// replaced in one go, clients never read half of it
+		if (rename(tmp, path) == -1) {
+			sway_log_errno(L_INFO, "Unable to write %s", path);
+			unlink(tmp);
+		}
+	}
+	free(tmp);
+	free(path);
+}
+
+static void ipc_remove_socketpath_file(void) {
+	char *path = ipc_socketpath_file();
+	if (!path) {
+		return;
+	}
+	char *line = ipc_read_socketpath_file();
+	// another sway might have started since
+	if (line && strcmp(line, ipc_sockaddr->sun_path) == 0) {
+		unlink(path);
+	}
+	free(line);
+	free(path);
+}
+
 void ipc_init(void) {
 	ipc_socket = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
 	if (ipc_socket == -1) {
@@ -73,8 +352,13 @@ void ipc_init(void) {
 	// Set i3 IPC socket path so that i3-msg works out of the box
 	setenv("I3SOCK", ipc_sockaddr->sun_path, 1);
 	setenv("SWAYSOCK", ipc_sockaddr->sun_path, 1);
+	ipc_write_socketpath_file();
 
 	ipc_client_list = create_list();
+	pending_events = create_list();
+	pixels_captures = create_list();
+	event_flush_timer = wlc_event_loop_add_timer(ipc_event_flush_timer, NULL);
+	capture_resume_timer = wlc_event_loop_add_timer(ipc_capture_resume_timer, NULL);
 
 	ipc_event_source = wlc_event_loop_add_fd(ipc_socket, WLC_EVENT_READABLE, ipc_handle_connection, NULL);
 }
@@ -83,8 +367,18 @@ void ipc_terminate(void) {
 	if (ipc_event_source) {
 		wlc_event_source_remove(ipc_event_source);
 	}
+	if (event_flush_timer) {
+		wlc_event_source_remove(event_flush_timer);
+	}
+	if (capture_resume_timer) {
+		wlc_event_source_remove(capture_resume_timer);
+	}
 	close(ipc_socket);
 	unlink(ipc_sockaddr->sun_path);
+	ipc_remove_socketpath_file();
+	ipc_state_terminate();
+	cbor_buffer_finish(&cbor_payload);
+	free(window_event_buffer);
 
 	list_free(ipc_client_list);
 
@@ -131,10 +425,22 @@ int ipc_handle_connection(int fd, uint32_t mask, void *data) {
 		sway_log_errno(L_INFO, "Unable to set CLOEXEC on IPC client socket");
 		return 0;
 	}
+	// a client that stops reading must not block the compositor
+	if ((flags=fcntl(client_fd, F_GETFL)) == -1 || fcntl(client_fd, F_SETFL, flags|O_NONBLOCK) == -1) {
+		sway_log_errno(L_INFO, "Unable to set NONBLOCK on IPC client socket");
+		return 0;
+	}
 
-	struct ipc_client* client = malloc(sizeof(struct ipc_client));
+	struct ipc_client* client = calloc(1, sizeof(struct ipc_client));
 	client->payload_length = 0;
 	client->fd = client_fd;
+	client->shm_fd = -1;
+	client->send_fd = -1;
+	struct ucred cred;
+	socklen_t cred_length = sizeof(cred);
+	if (getsockopt(client_fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_length) == 0) {
+		client->pid = cred.pid;
+	}
 	client->event_source = wlc_event_loop_add_fd(client_fd, WLC_EVENT_READABLE, ipc_client_handle_readable, client);
 
 	list_add(ipc_client_list, client);
@@ -144,82 +450,225 @@ int ipc_handle_connection(int fd, uint32_t mask, void *data) {
 
 static const int ipc_header_size = sizeof(ipc_magic)+8;
 
+// Largest request payload accepted, the read buffer never grows past one
+// request of this size.
+#define IPC_MAX_PAYLOAD (4 * 1024 * 1024)
+
+// Checks the header of the next message and returns its payload length, or
+// disconnects the client and returns false if the message can't be valid.
+static bool ipc_client_check_header(struct ipc_client *client, const char *header, uint32_t *length) {
+	if (memcmp(header, ipc_magic, sizeof(ipc_magic)) != 0) {
+		sway_log(L_DEBUG, "IPC header check failed");
+		ipc_client_disconnect(client, IPC_DISCONNECT_BAD_MESSAGE);
+		return false;
+	}
+	memcpy(length, header + sizeof(ipc_magic), sizeof(*length));
+	if (*length > IPC_MAX_PAYLOAD) {
+		sway_log(L_INFO, "IPC client %d sent a %u byte payload, limit is %d. Disconnecting",
+				client->fd, *length, IPC_MAX_PAYLOAD);
+		ipc_client_disconnect(client, IPC_DISCONNECT_BAD_MESSAGE);
+		return false;
+	}
+	return true;
+}
+
+static void ipc_client_dispatch(struct ipc_client *client);
+
 int ipc_client_handle_readable(int client_fd, uint32_t mask, void *data) {
 	struct ipc_client *client = data;
 
 	if (mask & WLC_EVENT_ERROR) {
 		sway_log(L_INFO, "IPC Client socket error, removing client");
 		client->fd = -1;
-		ipc_client_disconnect(client);
+		ipc_client_disconnect(client, IPC_DISCONNECT_ERROR);
 		return 0;
 	}
 
 	if (mask & WLC_EVENT_HANGUP) {
 		client->fd = -1;
-		ipc_client_disconnect(client);
+		ipc_client_disconnect(client, IPC_DISCONNECT_CLOSED);
 		return 0;
 	}
 
-	int read_available;
-	if (ioctl(client_fd, FIONREAD, &read_available) == -1) {
-		sway_log_errno(L_INFO, "Unable to read IPC socket buffer size");
-		ipc_client_disconnect(client);
-		return 0;
+	// Read everything there is, a client may send several requests at once
+	while (true) {
+		// keep a spare byte to terminate the last payload with
+		if (client->read_size - client->read_len < 2) {
+			// the buffer starts with the first unhandled message, don't grow
+			// it for one that will be rejected anyway
+			uint32_t length;
+			if (client->read_len >= (size_t)ipc_header_size
+					&& !ipc_client_check_header(client, client->read_buffer, &length)) {
+				return 0;
+			}
+			size_t limit = ipc_header_size + IPC_MAX_PAYLOAD + 1;
+			if (client->read_size >= limit) {
+				// full of whole requests, handle those first
+				break;
+			}
+			client->read_size = client->read_size ? client->read_size * 2 : 4096;
+			if (client->read_size > limit) {
+				client->read_size = limit;
+			}
+			client->read_buffer = realloc(client->read_buffer, client->read_size);
+		}
+		size_t space = client->read_size - client->read_len - 1;
+		ssize_t received = recv(client_fd, client->read_buffer + client->read_len, space, 0);
+		if (received == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+			sway_log_errno(L_INFO, "Unable to receive from IPC client");
+			ipc_client_disconnect(client, IPC_DISCONNECT_ERROR);
+			return 0;
+		}
+		if (received == 0) {
+			ipc_client_disconnect(client, IPC_DISCONNECT_CLOSED);
+			return 0;
+		}
+		client->read_len += received;
+		if ((size_t)received < space) {
+			break;
+		}
 	}
 
-	// Wait for the rest of the command payload in case the header has already been read
-	if (client->payload_length > 0) {
-		if ((uint32_t)read_available >= client->payload_length) {
-			ipc_client_handle_command(client);
+	ipc_client_dispatch(client);
+	return 0;
+}
+
+// Handles every complete message in the read buffer, in place, until a
+// capture has to wait for a frame. May free the client.
+static void ipc_client_dispatch(struct ipc_client *client) {
+	size_t offset = 0;
+	client->dispatching = true;
+	while (!client->disconnected && !client->capture_pending
+			&& client->read_len - offset >= (size_t)ipc_header_size) {
+		char *header = client->read_buffer + offset;
+		uint32_t length, type;
+		if (!ipc_client_check_header(client, header, &length)) {
+			break;
 		}
-		return 0;
+		if (client->read_len - offset - ipc_header_size < length) {
+			break;
+		}
+		memcpy(&type, header + sizeof(ipc_magic) + sizeof(length), sizeof(type));
+		client->payload_length = length;
+		client->current_command = (enum ipc_command_type)type;
+		char *payload = header + ipc_header_size;
+		offset += ipc_header_size + client->payload_length;
+		// handlers expect a terminated payload, borrow the next header's
+		// first byte (or the spare one)
+		char next = payload[client->payload_length];
+		payload[client->payload_length] = '\0';
+		struct ipc_message_stats *stats = ipc_message_stats(type);
+		++client->messages;
+		client->bytes_in += ipc_header_size + client->payload_length;
+		uint64_t start = ipc_now_ns();
+		ipc_client_handle_command(client, payload);
+		if (stats) {
+			++stats->count;
+			stats->bytes_in += ipc_header_size + client->payload_length;
+			ipc_stats_latency(stats, ipc_now_ns() - start);
+		}
+		payload[client->payload_length] = next;
+		client->payload_length = 0;
 	}
+	client->dispatching = false;
 
-	if (read_available < ipc_header_size) {
-		return 0;
+	if (client->disconnected) {
+		free(client->read_buffer);
+		free(client);
+		return;
 	}
-
-	uint8_t buf[ipc_header_size];
-	uint32_t *buf32 = (uint32_t*)(buf + sizeof(ipc_magic));
-	ssize_t received = recv(client_fd, buf, ipc_header_size, 0);
-	if (received == -1) {
-		sway_log_errno(L_INFO, "Unable to receive header from IPC client");
-		ipc_client_disconnect(client);
-		return 0;
+	if (client->capture_pending && client->event_source) {
+		// level triggered, it would fire until the requests are read
+		wlc_event_source_remove(client->event_source);
+		client->event_source = NULL;
 	}
-
-	if (memcmp(buf, ipc_magic, sizeof(ipc_magic)) != 0) {
-		sway_log(L_DEBUG, "IPC header check failed");
-		ipc_client_disconnect(client);
-		return 0;
+	client->read_len -= offset;
+	if (client->read_len) {
+		memmove(client->read_buffer, client->read_buffer + offset, client->read_len);
+	} else if (client->read_size > 4096) {
+		// don't hold on to the memory of a large request
+		free(client->read_buffer);
+		client->read_buffer = NULL;
+		client->read_size = 0;
 	}
+}
 
-	client->payload_length = buf32[0];
-	client->current_command = (enum ipc_command_type)buf32[1];
-
-	if (read_available - received >= client->payload_length) {
-		ipc_client_handle_command(client);
+int ipc_capture_resume_timer(void *data) {
+	int i;
+	// backwards, handling requests may disconnect a client
+	for (i = ipc_client_list->length - 1; i >= 0; --i) {
+		struct ipc_client *client = ipc_client_list->items[i];
+		if (client->event_source || client->capture_pending) {
+			continue;
+		}
+		client->event_source = wlc_event_loop_add_fd(client->fd, WLC_EVENT_READABLE,
+				ipc_client_handle_readable, client);
+		ipc_client_dispatch(client);
 	}
-
 	return 0;
 }
 
-void ipc_client_disconnect(struct ipc_client *client)
+void ipc_client_disconnect(struct ipc_client *client, enum ipc_disconnect_reason reason)
 {
 	if (!sway_assert(client != NULL, "client != NULL")) {
 		return;
 	}
+	if (client->disconnected) {
+		return;
+	}
+	++ipc_stats.disconnects[reason];
 
 	if (client->fd != -1) {
 		shutdown(client->fd, SHUT_RDWR);
 	}
 
 	sway_log(L_INFO, "IPC Client %d disconnected", client->fd);
-	wlc_event_source_remove(client->event_source);
-	int i = 0;
+	if (client->event_source) {
+		wlc_event_source_remove(client->event_source);
+	}
+	if (client->writable_event_source) {
+		wlc_event_source_remove(client->writable_event_source);
+	}
+	ipc_write_stats.queued_bytes -= client->write_len;
+	free(client->write_buffer);
+	if (client->shm_data) {
+		munmap(client->shm_data, client->shm_size);
+		client->shm_data = NULL;
+	}
+	if (client->shm_fd != -1) {
+		close(client->shm_fd);
+		client->shm_fd = -1;
+	}
+	if (client->event_filters) {
+		list_foreach(client->event_filters, free_event_filter);
+		list_free(client->event_filters);
+		client->event_filters = NULL;
+	}
+	if (client->state_shm && --state_shm_clients == 0) {
+		// nobody left to read it, stop updating it
+		ipc_state_terminate();
+	}
+	int i;
+	for (i = 0; i < pixels_captures->length; ++i) {
+		struct pixels_capture *capture = pixels_captures->items[i];
+		if (capture->client == client) {
+			capture->client = NULL;
+		}
+	}
+	i = 0;
 	while (i < ipc_client_list->length && ipc_client_list->items[i] != client) i++;
 	list_del(ipc_client_list, i);
 	close(client->fd);
+	client->fd = -1;
+	if (client->dispatching) {
+		// ipc_client_handle_readable frees it
+		client->disconnected = true;
+		return;
+	}
+	free(client->read_buffer);
 	free(client);
 }
 
@@ -231,84 +680,648 @@ bool output_by_name_test(swayc_t *view, void *data) {
 	return !strcmp(name, view->name);
 }
 
-bool get_pixels_callback(const struct wlc_size *size, uint8_t *rgba, void *arg) {
-	struct ipc_client *client = (struct ipc_client *)arg;
+// The payload is either just the output name or a json object like
+// {"output": "eDP-1", "x": 0, "y": 0, "width": 320, "height": 200,
+// "scale": 2, "top_down": true, "delta": true}, where everything but output
+// is optional.
+static swayc_t *pixels_request_parse(const char *buf, struct pixels_request *req) {
+	memset(req, 0, sizeof(struct pixels_request));
+	req->scale = 1;
+	if (buf[0] != '{') {
+		return swayc_by_test(&root_container, output_by_name_test, (void *)buf);
+	}
+	json_object *request = json_tokener_parse(buf);
+	if (!request) {
+		return NULL;
+	}
+	json_object *value;
+	swayc_t *output = NULL;
+	if (json_object_object_get_ex(request, "output", &value)) {
+		output = swayc_by_test(&root_container, output_by_name_test,
+				(void *)json_object_get_string(value));
+	}
+	if (json_object_object_get_ex(request, "x", &value)) {
+		req->region.origin.x = json_object_get_int(value);
+	}
+	if (json_object_object_get_ex(request, "y", &value)) {
+		req->region.origin.y = json_object_get_int(value);
+	}
+	if (json_object_object_get_ex(request, "width", &value)) {
+		req->region.size.w = json_object_get_int(value);
+	}
+	if (json_object_object_get_ex(request, "height", &value)) {
+		req->region.size.h = json_object_get_int(value);
+	}
+	if (json_object_object_get_ex(request, "scale", &value) && json_object_get_int(value) > 1) {
+		req->scale = json_object_get_int(value);
+	}
+	if (json_object_object_get_ex(request, "top_down", &value)) {
+		req->top_down = json_object_get_boolean(value);
+	}
+	if (json_object_object_get_ex(request, "delta", &value)) {
+		req->delta = json_object_get_boolean(value);
+	}
+	json_object_put(request);
+	return output;
+}
+
+// Clips the region of req to the frame and returns the size of the pixels
+// the request gets.
+static struct wlc_size pixels_request_size(struct pixels_request *req, const struct wlc_size *size) {
+	struct wlc_geometry *region = &req->region;
+	if (region->size.w == 0 || region->size.h == 0) {
+		*region = (struct wlc_geometry){ { 0, 0 }, *size };
+	}
+	// in 64 bits, the region comes from the client and may be any size
+	int64_t x1 = region->origin.x < 0 ? 0 : region->origin.x;
+	int64_t y1 = region->origin.y < 0 ? 0 : region->origin.y;
+	int64_t x2 = (int64_t)region->origin.x + region->size.w;
+	int64_t y2 = (int64_t)region->origin.y + region->size.h;
+	if (x2 > size->w) {
+		x2 = size->w;
+	}
+	if (y2 > size->h) {
+		y2 = size->h;
+	}
+	if (x1 >= x2 || y1 >= y2) {
+		*region = (struct wlc_geometry){ { 0, 0 }, { 0, 0 } };
+		return region->size;
+	}
+	*region = (struct wlc_geometry){ { (int32_t)x1, (int32_t)y1 },
+		{ (uint32_t)(x2 - x1), (uint32_t)(y2 - y1) } };
+	if (req->scale > region->size.w || req->scale > region->size.h) {
+		req->scale = region->size.w < region->size.h ? region->size.w : region->size.h;
+	}
+	return (struct wlc_size){ region->size.w / req->scale, region->size.h / req->scale };
+}
+
+// Returns w pixels of row y (counted from the top) of the requested pixels,
+// starting at x. Rows of rgba start at the bottom, as GL reads them. Scaled
+// rows are computed into scratch, others point into rgba.
+static const uint8_t *pixels_request_row(const struct pixels_request *req, const struct wlc_size *size,
+		const uint8_t *rgba, uint32_t y, uint32_t x, uint32_t w, uint8_t *scratch) {
+	const struct wlc_geometry *region = &req->region;
+	uint32_t scale = req->scale;
+	if (scale == 1) {
+		return rgba + ((size->h - 1 - (region->origin.y + y)) * size->w
+				+ region->origin.x + x) * 4;
+	}
+	// a block of a large scale holds more than UINT32_MAX / 255 pixels
+	uint64_t blocks = (uint64_t)scale * scale;
+	uint32_t i;
+	for (i = 0; i < w; ++i) {
+		uint64_t sum[4] = { 0, 0, 0, 0 };
+		uint32_t dy, dx, c;
+		for (dy = 0; dy < scale; ++dy) {
+			uint32_t row = size->h - 1 - (region->origin.y + y * scale + dy);
+			const uint8_t *src = rgba + (row * size->w + region->origin.x + (x + i) * scale) * 4;
+			for (dx = 0; dx < scale * 4; dx += 4) {
+				for (c = 0; c < 4; ++c) {
+					sum[c] += src[dx + c];
+				}
+			}
+		}
+		for (c = 0; c < 4; ++c) {
+			scratch[i * 4 + c] = sum[c] / blocks;
+		}
+	}
+	return scratch;
+}
+
+// Copies the requested pixels of a frame to out, which has to fit
+// pixels_request_size of them.
+static void pixels_request_copy(const struct pixels_request *req, const struct wlc_size *size,
+		const uint8_t *rgba, const struct wlc_size *out_size, uint8_t *out) {
+	size_t out_stride = out_size->w * 4;
+	if (req->scale == 1 && !req->top_down
+			&& req->region.size.w == size->w && req->region.size.h == size->h) {
+		memcpy(out, rgba, out_stride * out_size->h);
+		return;
+	}
+	uint32_t y;
+	for (y = 0; y < out_size->h; ++y) {
+		uint32_t out_y = req->top_down ? y : out_size->h - 1 - y;
+		uint8_t *dst = out + out_y * out_stride;
+		const uint8_t *row = pixels_request_row(req, size, rgba, y, 0, out_size->w, dst);
+		if (row != dst) {
+			memcpy(dst, row, out_stride);
+		}
+	}
+}
+
+// Updates out, which holds the previous frame, with the tiles of the
+// requested pixels that changed. Comparing with what out holds needs no
+// extra copy of the frame, and memcmp is vectorized already. Returns the
+// changed tiles as x, y, width, height in rows of out.
+static list_t *pixels_request_copy_delta(const struct pixels_request *req, const struct wlc_size *size,
+		const uint8_t *rgba, const struct wlc_size *out_size, uint8_t *out) {
+	static const uint32_t tile = IPC_PIXELS_TILE_SIZE;
+	list_t *tiles = create_list();
+	size_t out_stride = out_size->w * 4;
+	uint32_t columns = (out_size->w + tile - 1) / tile;
+	bool *changed = malloc(columns * sizeof(bool));
+	uint8_t *scratch = malloc(out_stride);
+	uint32_t tile_y;
+	for (tile_y = 0; tile_y < out_size->h; tile_y += tile) {
+		uint32_t h = out_size->h - tile_y < tile ? out_size->h - tile_y : tile;
+		memset(changed, 0, columns * sizeof(bool));
+		uint32_t y;
+		for (y = tile_y; y < tile_y + h; ++y) {
+			uint32_t out_y = req->top_down ? y : out_size->h - 1 - y;
+			uint8_t *dst = out + out_y * out_stride;
+			const uint8_t *row = pixels_request_row(req, size, rgba, y, 0, out_size->w, scratch);
+			uint32_t column;
+			for (column = 0; column < columns; ++column) {
+				size_t offset = column * tile * 4;
+				size_t length = (out_size->w - column * tile < tile ? out_size->w - column * tile : tile) * 4;
+				if (memcmp(dst + offset, row + offset, length) != 0) {
+					memcpy(dst + offset, row + offset, length);
+					changed[column] = true;
+				}
+			}
+		}
+		uint32_t column;
+		for (column = 0; column < columns; ++column) {
+			if (!changed[column]) {
+				continue;
+			}
+			uint32_t *rect = malloc(4 * sizeof(uint32_t));
+			rect[0] = column * tile;
+			rect[1] = req->top_down ? tile_y : out_size->h - tile_y - h;
+			rect[2] = out_size->w - rect[0] < tile ? out_size->w - rect[0] : tile;
+			rect[3] = h;
+			list_add(tiles, rect);
+		}
+	}
+	free(scratch);
+	free(changed);
+	return tiles;
+}
+
+// Asks wlc for the next frame of output, cb gets a struct pixels_capture.
+static void pixels_capture_request(struct ipc_client *client, swayc_t *output,
+		const struct pixels_request *req,
+		bool (*cb)(const struct wlc_size *, uint8_t *, void *)) {
+	struct pixels_capture *capture = calloc(1, sizeof(struct pixels_capture));
+	if (!capture) {
+		sway_log(L_ERROR, "Unable to allocate pixel capture");
+		char response_header[9] = { 0 };
+		ipc_send_reply(client, response_header, sizeof(response_header));
+		return;
+	}
+	capture->client = client;
+	capture->request = *req;
+	capture->type = client->current_command;
+	client->capture_pending = true;
+	list_add(pixels_captures, capture);
+	wlc_output_get_pixels(output->handle, cb, capture);
+}
+
+// Takes a frame's capture off the pending list and returns its client, or
+// NULL if there is nobody to reply to any more. The client's later requests
+// are handled once the frame callback returned.
+static struct ipc_client *pixels_capture_finish(struct pixels_capture *capture) {
+	int i;
+	for (i = 0; i < pixels_captures->length; ++i) {
+		if (pixels_captures->items[i] == capture) {
+			list_del(pixels_captures, i);
+			break;
+		}
+	}
+	if (capture->client) {
+		capture->client->capture_pending = false;
+		wlc_event_source_timer_update(capture_resume_timer, 1);
+	}
+	return capture->client;
+}
+
+// Replies to the request the capture was made for. Pixel replies are binary
+// whatever the client's encoding.
+static void pixels_capture_reply(struct ipc_client *client, const struct pixels_capture *capture,
+		const char *payload, uint32_t payload_length) {
+	ipc_send_payload(client, capture->type, payload, payload_length);
+}
+
+static void pixels_reply(struct ipc_client *client, struct pixels_capture *capture,
+		const struct wlc_size *size, uint8_t *rgba) {
+	struct pixels_request *req = &capture->request;
 	char response_header[9];
 	memset(response_header, 0, sizeof(response_header));
-	response_header[0] = 1;
+	struct wlc_size out_size = pixels_request_size(req, size);
+	response_header[0] = IPC_PIXELS_DONE;
+	if (req->top_down) {
+		response_header[0] |= IPC_PIXELS_TOP_DOWN;
+	}
 	uint32_t *_size = (uint32_t *)(response_header + 1);
-	_size[0] = size->w;
-	_size[1] = size->h;
-	size_t len = sizeof(response_header) + (size->w * size->h * 4);
+	_size[0] = out_size.w;
+	_size[1] = out_size.h;
+	size_t len = sizeof(response_header) + (out_size.w * out_size.h * 4);
 	char *payload = malloc(len);
 	memcpy(payload, response_header, sizeof(response_header));
-	memcpy(payload + sizeof(response_header), rgba, len - sizeof(response_header));
-	ipc_send_reply(client, payload, len);
+	pixels_request_copy(req, size, rgba, &out_size,
+			(uint8_t *)payload + sizeof(response_header));
+	pixels_capture_reply(client, capture, payload, len);
 	free(payload);
+}
+
+bool get_pixels_callback(const struct wlc_size *size, uint8_t *rgba, void *arg) {
+	struct ipc_client *client = pixels_capture_finish(arg);
+	if (client) {
+		pixels_reply(client, arg, size, rgba);
+	}
+	free(arg);
 	return false;
 }
 
-void ipc_client_handle_command(struct ipc_client *client) {
-	if (!sway_assert(client != NULL, "client != NULL")) {
-		return;
+// Replaces the client's shared buffer if the frame doesn't fit. Returns true
+// if there is a new one the client has to be sent.
+static bool ipc_client_resize_shm(struct ipc_client *client, size_t size) {
+	if (client->shm_fd != -1 && client->shm_size == size) {
+		return false;
+	}
+	if (client->shm_data) {
+		munmap(client->shm_data, client->shm_size);
+		client->shm_data = NULL;
+	}
+	if (client->shm_fd != -1) {
+		close(client->shm_fd);
 	}
+	client->shm_size = 0;
+	client->shm_fd = memfd_create("sway-pixels", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (client->shm_fd == -1) {
+		sway_log_errno(L_ERROR, "Unable to create shared pixel buffer");
+		return false;
+	}
+	// the client must not be able to shrink it under sway's mapping
+	void *data;
+	if (ftruncate(client->shm_fd, size) == -1
+			|| fcntl(client->shm_fd, F_ADD_SEALS, F_SEAL_SHRINK) == -1
+			|| (data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, client->shm_fd, 0)) == MAP_FAILED) {
+		sway_log_errno(L_ERROR, "Unable to set up shared pixel buffer");
+		close(client->shm_fd);
+		client->shm_fd = -1;
+		return false;
+	}
+	client->shm_data = data;
+	client->shm_size = size;
+	return true;
+}
 
-	char *buf = malloc(client->payload_length + 1);
-	if (client->payload_length > 0)
-	{
-		ssize_t received = recv(client->fd, buf, client->payload_length, 0);
-		if (received == -1)
-		{
-			sway_log_errno(L_INFO, "Unable to receive payload from IPC client");
-			ipc_client_disconnect(client);
-			free(buf);
+static void pixels_shm_reply(struct ipc_client *client, struct pixels_capture *capture,
+		const struct wlc_size *size, uint8_t *rgba) {
+	struct pixels_request *req = &capture->request;
+	char response_header[9];
+	memset(response_header, 0, sizeof(response_header));
+	struct wlc_size out_size = pixels_request_size(req, size);
+	size_t len = out_size.w * out_size.h * 4;
+	if (len == 0) {
+		// nothing of the region is on the output
+		response_header[0] = IPC_PIXELS_DONE;
+		pixels_capture_reply(client, capture, response_header, sizeof(response_header));
+		return;
+	}
+	if (client->send_fd != -1) {
+		// the last buffer isn't out yet, it can't be replaced
+		if (client->shm_size != len) {
+			sway_log(L_ERROR, "IPC GET_PIXELS_SHM requested before the last buffer was sent");
+			pixels_capture_reply(client, capture, response_header, sizeof(response_header));
 			return;
 		}
+	} else if (ipc_client_resize_shm(client, len)) {
+		response_header[0] |= IPC_PIXELS_NEW_BUFFER;
+		client->send_fd = client->shm_fd;
+		client->send_fd_offset = client->write_len;
+	}
+	if (client->shm_fd == -1) {
+		pixels_capture_reply(client, capture, response_header, sizeof(response_header));
+		return;
+	}
+	response_header[0] |= IPC_PIXELS_DONE;
+	if (req->top_down) {
+		response_header[0] |= IPC_PIXELS_TOP_DOWN;
+	}
+	uint32_t *_size = (uint32_t *)(response_header + 1);
+	_size[0] = out_size.w;
+	_size[1] = out_size.h;
+	// a new buffer holds no previous frame
+	if (!req->delta || (response_header[0] & IPC_PIXELS_NEW_BUFFER)) {
+		pixels_request_copy(req, size, rgba, &out_size, client->shm_data);
+		pixels_capture_reply(client, capture, response_header, sizeof(response_header));
+		return;
+	}
+
+	list_t *tiles = pixels_request_copy_delta(req, size, rgba,
+			&out_size, client->shm_data);
+	response_header[0] |= IPC_PIXELS_DELTA;
+	size_t reply_len = sizeof(response_header) + (1 + tiles->length * 4) * sizeof(uint32_t);
+	char *reply = malloc(reply_len);
+	memcpy(reply, response_header, sizeof(response_header));
+	uint32_t *reply32 = (uint32_t *)(reply + sizeof(response_header));
+	reply32[0] = tiles->length;
+	int i;
+	for (i = 0; i < tiles->length; ++i) {
+		memcpy(reply32 + 1 + i * 4, tiles->items[i], 4 * sizeof(uint32_t));
+	}
+	free_flat_list(tiles);
+	pixels_capture_reply(client, capture, reply, reply_len);
+	free(reply);
+}
+
+bool get_pixels_shm_callback(const struct wlc_size *size, uint8_t *rgba, void *arg) {
+	struct ipc_client *client = pixels_capture_finish(arg);
+	if (client) {
+		pixels_shm_reply(client, arg, size, rgba);
+	}
+	free(arg);
+	return false;
+}
+
+static enum ipc_command_type ipc_event_by_name(const char *name) {
+	if (!name) {
+		return IPC_COMMAND;
+	} else if (strcmp(name, "workspace") == 0) {
+		return IPC_EVENT_WORKSPACE;
+	} else if (strcmp(name, "barconfig_update") == 0) {
+		return IPC_EVENT_BARCONFIG_UPDATE;
+	} else if (strcmp(name, "mode") == 0) {
+		return IPC_EVENT_MODE;
+	} else if (strcmp(name, "modifier") == 0) {
+		return IPC_EVENT_MODIFIER;
+	} else if (strcmp(name, "window") == 0) {
+		return IPC_EVENT_WINDOW;
+#if SWAY_BINDING_EVENT
+	} else if (strcmp(name, "binding") == 0) {
+		return IPC_EVENT_BINDING;
+#endif
+	}
+	return IPC_COMMAND;
+}
+
+// Parses a filtered subscription, e.g.
+// { "event": "workspace", "output": "HDMI-A-1", "workspace": "1*", "change": [ "focus", "init" ] }
+static struct ipc_event_filter *ipc_event_filter_parse(json_object *json) {
+	json_object *event, *output, *workspace, *change;
+	if (!json_object_object_get_ex(json, "event", &event)) {
+		return NULL;
+	}
+	struct ipc_event_filter *filter = calloc(1, sizeof(struct ipc_event_filter));
+	filter->event = ipc_event_by_name(json_object_get_string(event));
+	if (filter->event == IPC_COMMAND) {
+		free(filter);
+		return NULL;
+	}
+	if (json_object_object_get_ex(json, "output", &output) && output) {
+		filter->output = strdup(json_object_get_string(output));
+	}
+	if (json_object_object_get_ex(json, "workspace", &workspace) && workspace) {
+		filter->workspace = strdup(json_object_get_string(workspace));
+	}
+	if (json_object_object_get_ex(json, "change", &change) && change) {
+		filter->changes = create_list();
+		if (json_object_is_type(change, json_type_array)) {
+			int i;
+			for (i = 0; i < json_object_array_length(change); ++i) {
+				const char *value = json_object_get_string(json_object_array_get_idx(change, i));
+				if (value) {
+					list_add(filter->changes, strdup(value));
+				}
+			}
+		} else {
+			list_add(filter->changes, strdup(json_object_get_string(change)));
+		}
+	}
+	return filter;
+}
+
+// Adds one item of a SUBSCRIBE request, an event name or a filter object.
+static bool ipc_client_subscribe(struct ipc_client *client, json_object *item) {
+	if (json_object_is_type(item, json_type_object)) {
+		struct ipc_event_filter *filter = ipc_event_filter_parse(item);
+		if (!filter) {
+			return false;
+		}
+		if (!client->event_filters) {
+			client->event_filters = create_list();
+		}
+		list_add(client->event_filters, filter);
+		client->subscribed_events |= ipc_event_mask(filter->event);
+		return true;
+	}
+	enum ipc_command_type event = ipc_event_by_name(json_object_get_string(item));
+	if (event == IPC_COMMAND) {
+		return false;
+	}
+	client->subscribed_events |= ipc_event_mask(event);
+	client->unfiltered_events |= ipc_event_mask(event);
+	return true;
+}
+
+static bool ipc_attr_match(const char *const attr[2], const char *value, bool pattern) {
+	if (!attr[0] && !attr[1]) {
+		return true;
+	}
+	int i;
+	for (i = 0; i < 2; ++i) {
+		if (attr[i] && (pattern ? fnmatch(value, attr[i], 0) == 0 : strcmp(value, attr[i]) == 0)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool ipc_event_filter_match(const struct ipc_event_filter *filter,
+		const struct ipc_event_attrs *attrs) {
+	if (filter->changes && attrs->change
+			&& list_seq_find(filter->changes, (int (*)(const void *, const void *))strcmp, attrs->change) == -1) {
+		return false;
+	}
+	if (filter->output && !ipc_attr_match(attrs->output, filter->output, false)) {
+		return false;
+	}
+	if (filter->workspace && !ipc_attr_match(attrs->workspace, filter->workspace, true)) {
+		return false;
+	}
+	return true;
+}
+
+// attrs NULL matches any filter.
+static bool ipc_client_wants_event(struct ipc_client *client, enum ipc_command_type event,
+		const struct ipc_event_attrs *attrs) {
+	uint32_t mask = ipc_event_mask(event);
+	if (!(client->subscribed_events & mask)) {
+		return false;
+	}
+	if ((client->unfiltered_events & mask) || !attrs) {
+		return true;
+	}
+	int i;
+	for (i = 0; i < client->event_filters->length; ++i) {
+		struct ipc_event_filter *filter = client->event_filters->items[i];
+		if (filter->event == event && ipc_event_filter_match(filter, attrs)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Checked before an event is built, nothing is serialized for events that no
+// client's subscription matches.
+static bool ipc_event_wanted(enum ipc_command_type event, const struct ipc_event_attrs *attrs) {
+	int i;
+	for (i = 0; i < ipc_client_list->length; ++i) {
+		if (ipc_client_wants_event(ipc_client_list->items[i], event, attrs)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static json_object *ipc_json_describe_message_stats(struct ipc_message_stats *stats, bool request) {
+	json_object *object = json_object_new_object();
+	json_object_object_add(object, "count", json_object_new_int64(stats->count));
+	if (request) {
+		json_object_object_add(object, "bytes_in", json_object_new_int64(stats->bytes_in));
+	}
+	json_object_object_add(object, "bytes_out", json_object_new_int64(stats->bytes_out));
+	if (!request) {
+		return object;
+	}
+	// trailing empty buckets are left out
+	int length = IPC_LATENCY_BUCKETS;
+	while (length > 0 && stats->latency[length - 1] == 0) {
+		--length;
+	}
+	json_object *latency = json_object_new_array();
+	int i;
+	for (i = 0; i < length; ++i) {
+		json_object_array_add(latency, json_object_new_int64(stats->latency[i]));
+	}
+	json_object_object_add(object, "latency_histogram", latency);
+	json_object_object_add(object, "latency_total_us", json_object_new_int64(stats->latency_total_ns / 1000));
+	json_object_object_add(object, "latency_max_us", json_object_new_int64(stats->latency_max_ns / 1000));
+	return object;
+}
+
+static json_object *ipc_json_describe_client_stats(struct ipc_client *client) {
+	json_object *object = json_object_new_object();
+	json_object_object_add(object, "fd", json_object_new_int(client->fd));
+	json_object_object_add(object, "pid", client->pid ? json_object_new_int(client->pid) : NULL);
+	if (client->pid) {
+		char path[64];
+		snprintf(path, sizeof(path), "/proc/%d/comm", (int)client->pid);
+		FILE *f = fopen(path, "r");
+		char *comm = f ? read_line(f) : NULL;
+		if (f) {
+			fclose(f);
+		}
+		json_object_object_add(object, "name", comm ? json_object_new_string(comm) : NULL);
+		free(comm);
+	}
+	json_object_object_add(object, "messages", json_object_new_int64(client->messages));
+	json_object_object_add(object, "bytes_in", json_object_new_int64(client->bytes_in));
+	json_object_object_add(object, "bytes_out", json_object_new_int64(client->bytes_out));
+	json_object_object_add(object, "queued_bytes", json_object_new_int64(client->write_len));
+	json_object_object_add(object, "max_queued_bytes", json_object_new_int64(client->max_queued));
+	json_object *events = json_object_new_array();
+	int i;
+	for (i = 0; i < 16; ++i) {
+		if (client->subscribed_events & (1u << i)) {
+			const char *name = ipc_message_name((enum ipc_command_type)(1u << 31 | i));
+			if (name) {
+				json_object_array_add(events, json_object_new_string(name));
+			}
+		}
+	}
+	json_object_object_add(object, "events", events);
+	return object;
+}
+
+// The part of GET_IPC_STATS that isn't about writing to clients.
+static void ipc_json_describe_ipc_stats(json_object *json) {
+	json_object *requests = json_object_new_object();
+	json_object *events = json_object_new_object();
+	int i;
+	for (i = 0; i < IPC_STATS_SLOTS; ++i) {
+		struct ipc_message_stats *stats = &ipc_stats.messages[i];
+		if (stats->count == 0 && stats->bytes_out == 0) {
+			continue;
+		}
+		uint32_t type = i;
+		if (i >= 32) {
+			type = 1u << 31 | (i - 32);
+		} else if (i >= 16) {
+			type = 0x80 + (i - 16);
+		}
+		const char *name = ipc_message_name((enum ipc_command_type)type);
+		if (!name) {
+			continue;
+		}
+		bool request = i < 32;
+		json_object_object_add(request ? requests : events, name,
+				ipc_json_describe_message_stats(stats, request));
+	}
+	json_object *buckets = json_object_new_array();
+	for (i = 0; i < IPC_LATENCY_BUCKETS - 1; ++i) {
+		json_object_array_add(buckets, json_object_new_int64(1u << i));
+	}
+	json_object_object_add(json, "latency_buckets_us", buckets);
+	json_object_object_add(json, "requests", requests);
+	json_object_object_add(json, "events", events);
+
+	json_object *disconnects = json_object_new_object();
+	for (i = 0; i < IPC_DISCONNECT_REASONS; ++i) {
+		json_object_object_add(disconnects, ipc_disconnect_reason_names[i],
+				json_object_new_int64(ipc_stats.disconnects[i]));
+	}
+	json_object_object_add(json, "disconnects", disconnects);
+
+	json_object *clients = json_object_new_array();
+	for (i = 0; i < ipc_client_list->length; ++i) {
+		json_object_array_add(clients, ipc_json_describe_client_stats(ipc_client_list->items[i]));
+	}
+	json_object_object_add(json, "client_stats", clients);
+}
+
+// buf is the payload of the message, client->payload_length bytes and
+// terminated.
+void ipc_client_handle_command(struct ipc_client *client, char *buf) {
+	if (!sway_assert(client != NULL, "client != NULL")) {
+		return;
 	}
 
 	switch (client->current_command) {
 	case IPC_COMMAND:
+	case IPC_SWAY_COMMAND_BATCH:
 	{
-		buf[client->payload_length] = '\0';
-		struct cmd_results *results = handle_command(buf);
+		struct cmd_results *results = client->current_command == IPC_COMMAND ?
+			handle_command(buf) : handle_command_batch(buf);
 		const char *json = cmd_results_to_json(results);
-		char reply[256];
-		int length = snprintf(reply, sizeof(reply), "%s", json);
-		ipc_send_reply(client, reply, (uint32_t) length);
+		ipc_send_reply(client, json, (uint32_t)strlen(json));
 		free_cmd_results(results);
 		break;
 	}
 	case IPC_SUBSCRIBE:
 	{
-		buf[client->payload_length] = '\0';
 		struct json_object *request = json_tokener_parse(buf);
 		if (request == NULL) {
 			ipc_send_reply(client, "{\"success\": false}", 18);
-			ipc_client_disconnect(client);
-			free(buf);
+			ipc_client_disconnect(client, IPC_DISCONNECT_BAD_MESSAGE);
 			return;
 		}
 
 		// parse requested event types
 		for (int i = 0; i < json_object_array_length(request); i++) {
-			const char *event_type = json_object_get_string(json_object_array_get_idx(request, i));
-			if (strcmp(event_type, "workspace") == 0) {
-				client->subscribed_events |= IPC_EVENT_WORKSPACE;
-			} else if (strcmp(event_type, "barconfig_update") == 0) {
-				client->subscribed_events |= IPC_EVENT_BARCONFIG_UPDATE;
-			} else if (strcmp(event_type, "mode") == 0) {
-				client->subscribed_events |= IPC_EVENT_MODE;
-			} else if (strcmp(event_type, "modifier") == 0) {
-				client->subscribed_events |= IPC_EVENT_MODIFIER;
-#if SWAY_BINDING_EVENT
-			} else if (strcmp(event_type, "binding") == 0) {
-				client->subscribed_events |= IPC_EVENT_BINDING;
-#endif
-			} else {
+			json_object *item = json_object_array_get_idx(request, i);
+			if (json_object_is_type(item, json_type_string)
+					&& strcmp(json_object_get_string(item), "exact") == 0) {
+				// not an event, opts out of merging events per frame
+				client->exact_events = true;
+				continue;
+			}
+			if (!ipc_client_subscribe(client, item)) {
 				ipc_send_reply(client, "{\"success\": false}", 18);
-				ipc_client_disconnect(client);
+				ipc_client_disconnect(client, IPC_DISCONNECT_BAD_MESSAGE);
 				json_object_put(request);
-				free(buf);
 				return;
 			}
 		}
@@ -354,6 +1367,17 @@ void ipc_client_handle_command(struct ipc_client *client) {
 		json_object_put(outputs); // free
 		break;
 	}
+	case IPC_GET_TREE:
+	{
+		uint32_t length;
+		const char *json_string = ipc_json_describe_tree(&root_container, &length);
+		if (!json_string) {
+			ipc_send_reply(client, "{\"success\": false}", 18);
+			break;
+		}
+		ipc_send_reply(client, json_string, length);
+		break;
+	}
 	case IPC_GET_VERSION:
 	{
 #if defined SWAY_GIT_VERSION && defined SWAY_GIT_BRANCH && defined SWAY_VERSION_DATE
@@ -380,26 +1404,126 @@ void ipc_client_handle_command(struct ipc_client *client) {
 		const char *json_string = json_object_to_json_string(json);
 		ipc_send_reply(client, json_string, (uint32_t)strlen(json_string));
 		json_object_put(json); // free
-		free(full_version);
+		free(full_version);
+		break;
+	}
+	case IPC_SWAY_GET_PIXELS:
+	{
+		char response_header[9];
+		memset(response_header, 0, sizeof(response_header));
+		struct pixels_request req;
+		swayc_t *output = pixels_request_parse(buf, &req);
+		if (!output) {
+			sway_log(L_ERROR, "IPC GET_PIXELS request with unknown output name");
+			ipc_send_reply(client, response_header, sizeof(response_header));
+			break;
+		}
+		pixels_capture_request(client, output, &req, get_pixels_callback);
+		break;
+	}
+	case IPC_SWAY_GET_PIXELS_SHM:
+	{
+		char response_header[9];
+		memset(response_header, 0, sizeof(response_header));
+		struct pixels_request req;
+		swayc_t *output = pixels_request_parse(buf, &req);
+		if (!output) {
+			sway_log(L_ERROR, "IPC GET_PIXELS_SHM request with unknown output name");
+			ipc_send_reply(client, response_header, sizeof(response_header));
+			break;
+		}
+		pixels_capture_request(client, output, &req, get_pixels_shm_callback);
+		break;
+	}
+	case IPC_SWAY_GET_STATE_SHM:
+	{
+		int fd = ipc_state_fd();
+		bool success = fd != -1 && client->send_fd == -1;
+		if (!success) {
+			sway_log(L_ERROR, "IPC GET_STATE_SHM %s", fd == -1 ?
+				"failed to set up the shared state" : "requested while another buffer was being sent");
+		} else {
+			client->send_fd = fd;
+			client->send_fd_offset = client->write_len;
+			if (!client->state_shm) {
+				client->state_shm = true;
+				++state_shm_clients;
+			}
+		}
+		json_object *json = json_object_new_object();
+		json_object_object_add(json, "success", json_object_new_boolean(success));
+		json_object_object_add(json, "version", json_object_new_int(IPC_STATE_VERSION));
+		const char *json_string = json_object_to_json_string(json);
+		ipc_send_reply(client, json_string, (uint32_t)strlen(json_string));
+		json_object_put(json); // free
+		break;
+	}
+	case IPC_SWAY_SET_ENCODING:
+	{
+		enum ipc_encoding encoding;
+		bool success = true;
+		if (strcmp(buf, "json") == 0) {
+			encoding = IPC_ENCODING_JSON;
+		} else if (strcmp(buf, "cbor") == 0) {
+			encoding = IPC_ENCODING_CBOR;
+		} else {
+			success = false;
+		}
+		// the reply is still in the old encoding, so the client knows where
+		// the new one starts
+		if (success) {
+			ipc_send_reply(client, "{\"success\": true}", 17);
+			client->encoding = encoding;
+		} else {
+			ipc_send_reply(client, "{\"success\": false}", 18);
+		}
+		break;
+	}
+	case IPC_SWAY_GET_GEOMETRY_STATS:
+	{
+		json_object *json = json_object_new_object();
+		json_object_object_add(json, "issued", json_object_new_int64(geometry_stats.issued));
+		json_object_object_add(json, "skipped", json_object_new_int64(geometry_stats.skipped));
+		const char *json_string = json_object_to_json_string(json);
+		ipc_send_reply(client, json_string, (uint32_t)strlen(json_string));
+		json_object_put(json); // free
 		break;
 	}
-	case IPC_SWAY_GET_PIXELS:
+	case IPC_SWAY_GET_FRAME_STATS:
 	{
-		char response_header[9];
-		memset(response_header, 0, sizeof(response_header));
-		buf[client->payload_length] = '\0';
-		swayc_t *output = swayc_by_test(&root_container, output_by_name_test, buf);
-		if (!output) {
-			sway_log(L_ERROR, "IPC GET_PIXELS request with unknown output name");
-			ipc_send_reply(client, response_header, sizeof(response_header));
-			break;
+		json_object *outputs = json_object_new_array();
+		int i;
+		for (i = 0; i < root_container.children->length; ++i) {
+			swayc_t *output = root_container.children->items[i];
+			if (!output->frame_timing) {
+				continue;
+			}
+			json_object *json = frame_timing_json(output->frame_timing);
+			json_object_object_add(json, "name", output->name ? json_object_new_string(output->name) : NULL);
+			json_object_array_add(outputs, json);
 		}
-		wlc_output_get_pixels(output->handle, get_pixels_callback, client);
+		const char *json_string = json_object_to_json_string(outputs);
+		ipc_send_reply(client, json_string, (uint32_t)strlen(json_string));
+		json_object_put(outputs); // free
+		break;
+	}
+	case IPC_SWAY_GET_IPC_STATS:
+	{
+		json_object *json = json_object_new_object();
+		json_object_object_add(json, "clients", json_object_new_int(ipc_client_list->length));
+		json_object_object_add(json, "queued_bytes", json_object_new_int64(ipc_write_stats.queued_bytes));
+		json_object_object_add(json, "total_queued_bytes", json_object_new_int64(ipc_write_stats.total_queued_bytes));
+		json_object_object_add(json, "stalls", json_object_new_int64(ipc_write_stats.stalls));
+		json_object_object_add(json, "dropped_events", json_object_new_int64(ipc_write_stats.dropped_events));
+		json_object_object_add(json, "disconnected_clients", json_object_new_int64(ipc_write_stats.disconnected_clients));
+		ipc_json_describe_ipc_stats(json);
+		const char *json_string = json_object_to_json_string(json);
+		ipc_send_reply(client, json_string, (uint32_t)strlen(json_string));
+		json_object_put(json); // free
 		break;
 	}
 	case IPC_GET_BAR_CONFIG:
 	{
-		buf[client->payload_length] = '\0';
 		if (!buf[0]) {
 			// Send list of configured bar IDs
 			json_object *bars = json_object_new_array();
@@ -413,7 +1537,6 @@ void ipc_client_handle_command(struct ipc_client *client) {
 			json_object_put(bars); // free
 		} else {
 			// Send particular bar's details
-			buf[client->payload_length] = '\0';
 			struct bar_config *bar = NULL;
 			int i;
 			for (i = 0; i < config->bars->length; ++i) {
@@ -437,36 +1560,241 @@ void ipc_client_handle_command(struct ipc_client *client) {
 	}
 	default:
 		sway_log(L_INFO, "Unknown IPC command type %i", client->current_command);
-		ipc_client_disconnect(client);
+		ipc_client_disconnect(client, IPC_DISCONNECT_BAD_MESSAGE);
 		return;
 	}
 
-	client->payload_length = 0;
-	free(buf);
+}
+
+// Appends to the client's outgoing ring buffer, growing it as needed.
+static void ipc_client_queue(struct ipc_client *client, const char *data, size_t length) {
+	if (client->write_len + length > client->write_size) {
+		size_t size = client->write_size ? client->write_size : 4096;
+		while (size < client->write_len + length) {
+			size *= 2;
+		}
+		// unwrap into the new buffer
+		char *buffer = malloc(size);
+		size_t first = client->write_size - client->write_start;
+		if (first > client->write_len) {
+			first = client->write_len;
+		}
+		if (client->write_len) {
+			memcpy(buffer, client->write_buffer + client->write_start, first);
+			memcpy(buffer + first, client->write_buffer, client->write_len - first);
+		}
+		free(client->write_buffer);
+		client->write_buffer = buffer;
+		client->write_size = size;
+		client->write_start = 0;
+	}
+	size_t end = (client->write_start + client->write_len) % client->write_size;
+	size_t first = client->write_size - end;
+	if (first > length) {
+		first = length;
+	}
+	memcpy(client->write_buffer + end, data, first);
+	memcpy(client->write_buffer, data + first, length - first);
+	client->write_len += length;
+	ipc_write_stats.queued_bytes += length;
+	ipc_write_stats.total_queued_bytes += length;
+}
+
+// writev, but passes client->send_fd along once the data before it is out.
+// Callers must not write past send_fd_offset in one go.
+static ssize_t ipc_client_writev(struct ipc_client *client, struct iovec *iov, int iovcnt) {
+	if (client->send_fd == -1 || client->send_fd_offset > 0) {
+		ssize_t written = writev(client->fd, iov, iovcnt);
+		if (written > 0 && client->send_fd != -1) {
+			client->send_fd_offset -= written;
+		}
+		return written;
+	}
+	char control[CMSG_SPACE(sizeof(int))];
+	memset(control, 0, sizeof(control));
+	struct msghdr msg = {
+		.msg_iov = iov,
+		.msg_iovlen = iovcnt,
+		.msg_control = control,
+		.msg_controllen = sizeof(control),
+	};
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &client->send_fd, sizeof(int));
+	ssize_t written = sendmsg(client->fd, &msg, 0);
+	if (written > 0) {
+		client->send_fd = -1;
+	}
+	return written;
+}
+
+// Writes as much of the ring buffer as the socket takes. Returns false if the
+// client had to be disconnected.
+static bool ipc_client_flush(struct ipc_client *client) {
+	while (client->write_len) {
+		size_t length = client->write_len;
+		if (client->send_fd != -1 && client->send_fd_offset > 0
+				&& client->send_fd_offset < length) {
+			length = client->send_fd_offset;
+		}
+		size_t first = client->write_size - client->write_start;
+		if (first > length) {
+			first = length;
+		}
+		struct iovec iov[2] = {
+			{ client->write_buffer + client->write_start, first },
+			{ client->write_buffer, length - first },
+		};
+		ssize_t written = ipc_client_writev(client, iov, iov[1].iov_len ? 2 : 1);
+		if (written == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				return true;
+			}
+			sway_log_errno(L_INFO, "Unable to send data to IPC client");
+			ipc_client_disconnect(client, IPC_DISCONNECT_ERROR);
+			return false;
+		}
+		client->write_start = (client->write_start + written) % client->write_size;
+		client->write_len -= written;
+		ipc_write_stats.queued_bytes -= written;
+	}
+	return true;
+}
+
+int ipc_client_handle_writable(int client_fd, uint32_t mask, void *data) {
+	struct ipc_client *client = data;
+
+	if (mask & (WLC_EVENT_ERROR | WLC_EVENT_HANGUP)) {
+		client->fd = -1;
+		ipc_client_disconnect(client, IPC_DISCONNECT_CLOSED);
+		return 0;
+	}
+
+	if (ipc_client_flush(client) && client->write_len == 0) {
+		wlc_event_source_remove(client->writable_event_source);
+		client->writable_event_source = NULL;
+		// don't hold on to the memory of a large reply
+		free(client->write_buffer);
+		client->write_buffer = NULL;
+		client->write_size = client->write_start = 0;
+	}
+	return 0;
+}
+
+// Replies to these are binary, whatever the client's encoding.
+static bool ipc_reply_is_json(enum ipc_command_type type) {
+	return type != IPC_SWAY_GET_PIXELS && type != IPC_SWAY_GET_PIXELS_SHM;
+}
+
+static const char *ipc_payload_cbor(const char *json, uint32_t *length) {
+	if (!cbor_from_json(&cbor_payload, json, *length)) {
+		sway_log(L_ERROR, "Unable to transcode IPC payload to CBOR");
+		static const char cbor_null = (char)0xf6;
+		*length = 1;
+		return &cbor_null;
+	}
+	*length = cbor_payload.length;
+	return (const char *)cbor_payload.data;
 }
 
 bool ipc_send_reply(struct ipc_client *client, const char *payload, uint32_t payload_length) {
+	if (client->encoding == IPC_ENCODING_CBOR && ipc_reply_is_json(client->current_command)) {
+		payload = ipc_payload_cbor(payload, &payload_length);
+	}
+	return ipc_send_payload(client, client->current_command, payload, payload_length);
+}
+
+static void ipc_stats_sent(struct ipc_client *client, enum ipc_command_type type,
+		uint32_t payload_length) {
+	struct ipc_message_stats *stats = ipc_message_stats(type);
+	if (stats) {
+		stats->bytes_out += ipc_header_size + payload_length;
+		if ((uint32_t)type >> 31) {
+			++stats->count;
+		}
+	}
+	client->bytes_out += ipc_header_size + payload_length;
+}
+
+// An event counts towards the limit with its own size. A reply always fits,
+// only what was queued before it counts: a large reply to a client that keeps
+// up is fine, a client still sitting on earlier output is not reading.
+static bool ipc_client_over_limit(struct ipc_client *client, enum ipc_command_type type,
+		uint32_t payload_length) {
+	size_t queued = client->write_len;
+	if ((uint32_t)type >> 31) {
+		queued += ipc_header_size + payload_length;
+	}
+	return queued > config->ipc_buffer_limit;
+}
+
+// Sends payload as it is, as a message of the given type.
+static bool ipc_send_payload(struct ipc_client *client, enum ipc_command_type type,
+		const char *payload, uint32_t payload_length) {
 	assert(payload);
+	if (client->disconnected) {
+		return false;
+	}
 
 	char data[ipc_header_size];
 	uint32_t *data32 = (uint32_t*)(data + sizeof(ipc_magic));
 
 	memcpy(data, ipc_magic, sizeof(ipc_magic));
 	data32[0] = payload_length;
-	data32[1] = client->current_command;
-
-	if (write(client->fd, data, ipc_header_size) == -1) {
-		sway_log_errno(L_INFO, "Unable to send header to IPC client");
-		ipc_client_disconnect(client);
+	data32[1] = type;
+
+	size_t written = 0;
+	if (client->write_len == 0) {
+		struct iovec iov[2] = {
+			{ data, ipc_header_size },
+			{ (void *)payload, payload_length },
+		};
+		ssize_t ret = ipc_client_writev(client, iov, 2);
+		if (ret == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+			sway_log_errno(L_INFO, "Unable to send reply to IPC client");
+			ipc_client_disconnect(client, IPC_DISCONNECT_ERROR);
+			return false;
+		}
+		if (ret == (ssize_t)(ipc_header_size + payload_length)) {
+			ipc_stats_sent(client, type, payload_length);
+			return true;
+		}
+		written = ret == -1 ? 0 : ret;
+		++ipc_write_stats.stalls;
+	} else if (config->ipc_buffer_limit
+			&& ipc_client_over_limit(client, type, payload_length)) {
+		// Replies are never dropped, the client would lose track of which
+		// reply belongs to which request.
+		bool is_event = (uint32_t)type >> 31;
+		if (is_event && config->ipc_buffer_drop) {
+			++ipc_write_stats.dropped_events;
+			return true;
+		}
+		sway_log(L_INFO, "IPC client %d isn't reading, %zu bytes queued. Disconnecting",
+				client->fd, client->write_len);
+		++ipc_write_stats.disconnected_clients;
+		ipc_client_disconnect(client, IPC_DISCONNECT_NOT_READING);
 		return false;
 	}
 
-	if (write(client->fd, payload, payload_length) == -1) {
-		sway_log_errno(L_INFO, "Unable to send payload to IPC client");
-		ipc_client_disconnect(client);
-		return false;
+	if (written < (size_t)ipc_header_size) {
+		ipc_client_queue(client, data + written, ipc_header_size - written);
+		written = 0;
+	} else {
+		written -= ipc_header_size;
+	}
+	ipc_client_queue(client, payload + written, payload_length - written);
+	ipc_stats_sent(client, type, payload_length);
+	if (client->write_len > client->max_queued) {
+		client->max_queued = client->write_len;
 	}
 
+	if (!client->writable_event_source) {
+		client->writable_event_source = wlc_event_loop_add_fd(client->fd,
+				WLC_EVENT_WRITABLE, ipc_client_handle_writable, client);
+	}
 	return true;
 }
 
@@ -525,6 +1853,210 @@ void ipc_get_outputs_callback(swayc_t *container, void *data) {
 	}
 }
 
+// GET_TREE is written as text directly instead of building a json_object per
+// container. The buffer is kept between requests, the header needs the
+// payload length before any of it can be queued.
+//
+// Once growing the buffer fails, failed stays set until the next request
+// and every helper does nothing, the text written so far is incomplete.
+static struct {
+	char *data;
+	size_t size, len;
+	bool failed;
+} tree_json;
+
+static bool tree_json_reserve(size_t length) {
+	if (tree_json.failed) {
+		return false;
+	}
+	if (tree_json.len + length <= tree_json.size) {
+		return true;
+	}
+	size_t size = tree_json.size ? tree_json.size : 4096;
+	while (size < tree_json.len + length) {
+		size *= 2;
+	}
+	char *data = realloc(tree_json.data, size);
+	if (!sway_assert(data, "Unable to grow tree buffer")) {
+		tree_json.failed = true;
+		return false;
+	}
+	tree_json.data = data;
+	tree_json.size = size;
+	return true;
+}
+
+// Drops the trailing comma, or replaces it with c.
+static void tree_json_trim(char c) {
+	if (tree_json.failed) {
+		return;
+	}
+	if (c) {
+		tree_json.data[tree_json.len - 1] = c;
+	} else {
+		tree_json.len--;
+	}
+}
+
+static void tree_json_raw(const char *str) {
+	size_t length = strlen(str);
+	if (!tree_json_reserve(length)) {
+		return;
+	}
+	memcpy(tree_json.data + tree_json.len, str, length);
+	tree_json.len += length;
+}
+
+static void tree_json_string(const char *str) {
+	if (!str) {
+		tree_json_raw("null");
+		return;
+	}
+	static const char hex[] = "0123456789abcdef";
+	// worst case every byte becomes \u00XX
+	if (!tree_json_reserve(strlen(str) * 6 + 2)) {
+		return;
+	}
+	char *out = tree_json.data + tree_json.len;
+	*out++ = '"';
+	for (; *str; ++str) {
+		unsigned char c = *str;
+		if (c == '"' || c == '\\') {
+			*out++ = '\\';
+			*out++ = c;
+		} else if (c == '\n') {
+			*out++ = '\\';
+			*out++ = 'n';
+		} else if (c == '\t') {
+			*out++ = '\\';
+			*out++ = 't';
+		} else if (c < 0x20) {
+			memcpy(out, "\\u00", 4);
+			out[4] = hex[c >> 4];
+			out[5] = hex[c & 0xf];
+			out += 6;
+		} else {
+			*out++ = c;
+		}
+	}
+	*out++ = '"';
+	tree_json.len = out - tree_json.data;
+}
+
+static void tree_json_int(const char *key, int64_t value) {
+	char num[48];
+	snprintf(num, sizeof(num), "\"%s\":%" PRId64 ",", key, value);
+	tree_json_raw(num);
+}
+
+static void tree_json_bool(const char *key, bool value) {
+	char field[48];
+	snprintf(field, sizeof(field), "\"%s\":%s,", key, value ? "true" : "false");
+	tree_json_raw(field);
+}
+
+static const char *tree_json_type(swayc_t *c) {
+	switch (c->type) {
+	case C_ROOT: return "root";
+	case C_OUTPUT: return "output";
+	case C_WORKSPACE: return "workspace";
+	case C_VIEW: return c->is_floating ? "floating_con" : "con";
+	default: return "con";
+	}
+}
+
+static const char *tree_json_layout(swayc_t *c) {
+	switch (c->layout) {
+	case L_HORIZ: return "splith";
+	case L_VERT: return "splitv";
+	case L_STACKED: return "stacked";
+	case L_TABBED: return "tabbed";
+	default: return c->type == C_OUTPUT ? "output" : "none";
+	}
+}
+
+static void tree_json_nodes(const char *key, list_t *children, swayc_t *focused);
+
+static void tree_json_container(swayc_t *c, swayc_t *focused) {
+	if (tree_json.failed) {
+		return;
+	}
+	tree_json_raw("{");
+	tree_json_int("id", (intptr_t)c);
+	tree_json_raw("\"name\":");
+	tree_json_string(c->name);
+	tree_json_raw(",\"type\":");
+	tree_json_string(tree_json_type(c));
+	tree_json_raw(",\"layout\":");
+	tree_json_string(tree_json_layout(c));
+	tree_json_raw(",\"rect\":{");
+	tree_json_int("x", (int32_t)c->x);
+	tree_json_int("y", (int32_t)c->y);
+	tree_json_int("width", (int32_t)c->width);
+	// the last member can't carry a trailing comma
+	tree_json_trim('\0');
+	char height[32];
+	snprintf(height, sizeof(height), ",\"height\":%d},", (int32_t)c->height);
+	tree_json_raw(height);
+	tree_json_bool("visible", c->visible);
+	tree_json_bool("focused", c == focused);
+	tree_json_bool("urgent", false);
+	if (c->type == C_VIEW) {
+		tree_json_int("window", (int64_t)c->handle);
+		tree_json_bool("floating", c->is_floating);
+		tree_json_bool("sticky", c->sticky);
+		tree_json_raw("\"app_id\":");
+		tree_json_string(c->app_id);
+		tree_json_raw(",\"class\":");
+		tree_json_string(c->class);
+		tree_json_raw(",");
+	} else {
+		tree_json_raw("\"window\":null,");
+	}
+	if (c->type == C_WORKSPACE) {
+		tree_json_nodes("floating_nodes", c->floating, focused);
+	}
+	if (c->focused) {
+		char focus[48];
+		snprintf(focus, sizeof(focus), "\"focus\":[%" PRIdPTR "],", (intptr_t)c->focused);
+		tree_json_raw(focus);
+	} else {
+		tree_json_raw("\"focus\":[],");
+	}
+	tree_json_nodes("nodes", c->type == C_VIEW ? NULL : c->children, focused);
+	// replace the trailing comma
+	tree_json_trim('}');
+}
+
+static void tree_json_nodes(const char *key, list_t *children, swayc_t *focused) {
+	if (tree_json.failed) {
+		return;
+	}
+	tree_json_raw("\"");
+	tree_json_raw(key);
+	tree_json_raw("\":[");
+	if (children && children->length) {
+		int i;
+		for (i = 0; i < children->length; ++i) {
+			tree_json_container(children->items[i], focused);
+			tree_json_raw(",");
+		}
+		tree_json_trim('\0');
+	}
+	tree_json_raw("],");
+}
+
+const char *ipc_json_describe_tree(swayc_t *root, uint32_t *length) {
+	tree_json.len = 0;
+	tree_json.failed = false;
+	tree_json_container(root, get_focused_container(&root_container));
+	if (tree_json.failed) {
+		return NULL;
+	}
+	*length = (uint32_t)tree_json.len;
+	return tree_json.data;
+}
+
 json_object *ipc_json_describe_bar_config(struct bar_config *bar) {
 	if (!sway_assert(bar, "Bar must not be NULL")) {
 		return NULL;
@@ -591,23 +2123,284 @@ json_object *ipc_json_describe_bar_config(struct bar_config *bar) {
 	return json;
 }
 
-void ipc_send_event(const char *json_string, enum ipc_command_type event) {
+struct queued_event {
+	enum ipc_command_type type;
+	// a later event of the same type and key replaces this one, NULL for none
+	char *key;
+	char *json;
+	// owned copies of the event's attrs, the pointers point into strings
+	struct ipc_event_attrs attrs;
+	char *strings[5];
+	// merged events whose attrs didn't fit, matches every filter
+	bool broad;
+};
+
+static void free_queued_event(struct queued_event *queued) {
+	int i;
+	for (i = 0; i < 5; ++i) {
+		free(queued->strings[i]);
+	}
+	free(queued->key);
+	free(queued->json);
+	free(queued);
+}
+
+static const char *queued_event_string(struct queued_event *queued, int i, const char *str) {
+	queued->strings[i] = str ? strdup(str) : NULL;
+	return queued->strings[i];
+}
+
+static const struct ipc_event_attrs *queued_event_attrs(struct queued_event *queued) {
+	return queued->broad ? NULL : &queued->attrs;
+}
+
+static bool attr_equal(const char *a, const char *b) {
+	return a == b || (a && b && strcmp(a, b) == 0);
+}
+
+// Adds value to a pair of attrs unless it's there already. Returns false if
+// both slots are taken by other values.
+static bool attr_add(const char *attr[2], const char *value) {
+	if (!value || attr_equal(attr[0], value) || attr_equal(attr[1], value)) {
+		return true;
+	}
+	if (!attr[0]) {
+		attr[0] = value;
+	} else if (!attr[1]) {
+		attr[1] = value;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+static bool attr_merge(const char *merged[2], const char *const replaced[2]) {
+	if (!merged[0] && !merged[1]) {
+		return true;
+	}
+	if (!replaced[0] && !replaced[1]) {
+		// the replaced event matched any filter, so must the merged one
+		merged[0] = merged[1] = NULL;
+		return true;
+	}
+	return attr_add(merged, replaced[0]) && attr_add(merged, replaced[1]);
+}
+
+// The event replacing an earlier one has to reach everyone the earlier one
+// would have reached. Returns false if the attrs of both don't fit in one.
+static bool attrs_merge(struct ipc_event_attrs *merged, const struct ipc_event_attrs *replaced) {
+	if (!attr_equal(merged->change, replaced->change)) {
+		merged->change = NULL;
+	}
+	return attr_merge(merged->output, replaced->output)
+		&& attr_merge(merged->workspace, replaced->workspace);
+}
+
+static int event_batch_depth = 0;
+static list_t *batch_events = NULL;
+// flush even if no output renders (e.g. a mode change)
+static const int32_t event_flush_delay = 16;
+
+// Queues an event. An earlier event it replaces is dropped and the new one
+// goes last, so the queue keeps the order of the latest events.
+static void ipc_queue_event(list_t *queue, const char *json_string, enum ipc_command_type event,
+		const char *key, const struct ipc_event_attrs *attrs, bool merge_identical) {
+	struct ipc_event_attrs merged;
+	bool broad = attrs == NULL;
+	if (attrs) {
+		merged = *attrs;
+	}
+	int i, replaced = -1;
+	for (i = 0; i < queue->length; ++i) {
+		struct queued_event *queued = queue->items[i];
+		if (queued->type != event) {
+			continue;
+		}
+		if (key && queued->key && strcmp(queued->key, key) == 0) {
+			if (broad || queued->broad || !attrs_merge(&merged, &queued->attrs)) {
+				broad = true;
+			}
+			replaced = i;
+			break;
+		}
+		if (merge_identical && strcmp(queued->json, json_string) == 0) {
+			return;
+		}
+	}
+	struct queued_event *queued = calloc(1, sizeof(struct queued_event));
+	queued->type = event;
+	queued->key = key ? strdup(key) : NULL;
+	queued->json = strdup(json_string);
+	queued->broad = broad;
+	if (!broad) {
+		// merged may point into the replaced event, copy before it's freed
+		queued->attrs.change = queued_event_string(queued, 0, merged.change);
+		queued->attrs.output[0] = queued_event_string(queued, 1, merged.output[0]);
+		queued->attrs.output[1] = queued_event_string(queued, 2, merged.output[1]);
+		queued->attrs.workspace[0] = queued_event_string(queued, 3, merged.workspace[0]);
+		queued->attrs.workspace[1] = queued_event_string(queued, 4, merged.workspace[1]);
+	}
+	if (replaced != -1) {
+		free_queued_event(queue->items[replaced]);
+		list_del(queue, replaced);
+	}
+	list_add(queue, queued);
+}
+
+void ipc_event_batch_begin(void) {
+	if (event_batch_depth++ == 0) {
+		batch_events = create_list();
+	}
+}
+
+void ipc_event_batch_end(void) {
+	if (!sway_assert(event_batch_depth > 0, "Unbalanced IPC event batch")) {
+		return;
+	}
+	if (--event_batch_depth > 0) {
+		return;
+	}
+	int i;
+	for (i = 0; i < batch_events->length; ++i) {
+		struct queued_event *queued = batch_events->items[i];
+		ipc_send_event(queued->json, queued->type, queued->key, queued_event_attrs(queued));
+		free_queued_event(queued);
+	}
+	list_free(batch_events);
+	batch_events = NULL;
+}
+
+// Window events are numbered per client, so a filtered subscription only
+// sees gaps where events it asked for were dropped. The seq is spliced in
+// front of the serialized event, which can't be shared between clients then.
+static void ipc_send_window_event(struct ipc_client *client, const char *json, uint32_t length) {
+	char seq[32];
+	int seq_length = snprintf(seq, sizeof(seq), "{ \"seq\": %" PRIu64 ",", ++client->window_seq);
+	// the event's own '{' is replaced, the terminator added
+	size_t size = seq_length + length;
+	if (size > window_event_size) {
+		char *buffer = realloc(window_event_buffer, size);
+		if (!buffer) {
+			sway_log(L_ERROR, "Unable to allocate window event");
+			return;
+		}
+		window_event_buffer = buffer;
+		window_event_size = size;
+	}
+	memcpy(window_event_buffer, seq, seq_length);
+	memcpy(window_event_buffer + seq_length, json + 1, length - 1);
+	window_event_buffer[size - 1] = '\0';
+
+	const char *payload = window_event_buffer;
+	uint32_t payload_length = size - 1;
+	if (client->encoding == IPC_ENCODING_CBOR) {
+		payload = ipc_payload_cbor(payload, &payload_length);
+	}
+	ipc_send_payload(client, IPC_EVENT_WINDOW, payload, payload_length);
+}
+
+static void ipc_event_deliver(const char *json_string, enum ipc_command_type event,
+		const struct ipc_event_attrs *attrs, bool exact) {
 	int i;
 	struct ipc_client *client;
-	for (i = 0; i < ipc_client_list->length; i++) {
+	uint32_t json_length = strlen(json_string);
+	// transcoded once for all CBOR clients
+	const char *cbor = NULL;
+	uint32_t cbor_length = json_length;
+	// backwards, sending may disconnect a client that stopped reading
+	for (i = ipc_client_list->length - 1; i >= 0; i--) {
 		client = ipc_client_list->items[i];
-		if ((client->subscribed_events & event) == 0) {
+		if (client->exact_events != exact || !ipc_client_wants_event(client, event, attrs)) {
 			continue;
 		}
-		client->current_command = event;
-		ipc_send_reply(client, json_string, (uint32_t) strlen(json_string));
+		if (event == IPC_EVENT_WINDOW) {
+			ipc_send_window_event(client, json_string, json_length);
+		} else if (client->encoding == IPC_ENCODING_CBOR) {
+			if (!cbor) {
+				cbor = ipc_payload_cbor(json_string, &cbor_length);
+			}
+			ipc_send_payload(client, event, cbor, cbor_length);
+		} else {
+			ipc_send_payload(client, event, json_string, json_length);
+		}
+	}
+}
+
+void ipc_event_flush(void) {
+	// the snapshot has to be current before the events that announce it
+	ipc_state_update();
+	if (!pending_events || pending_events->length == 0) {
+		return;
+	}
+	wlc_event_source_timer_update(event_flush_timer, 0);
+	int i;
+	for (i = 0; i < pending_events->length; ++i) {
+		struct queued_event *queued = pending_events->items[i];
+		ipc_event_deliver(queued->json, queued->type, queued_event_attrs(queued), false);
+		free_queued_event(queued);
+	}
+	pending_events->length = 0;
+}
+
+int ipc_event_flush_timer(void *data) {
+	ipc_event_flush();
+	return 0;
+}
+
+void ipc_send_event(const char *json_string, enum ipc_command_type event, const char *key,
+		const struct ipc_event_attrs *attrs) {
+	if (event_batch_depth) {
+		ipc_queue_event(batch_events, json_string, event, key, attrs, true);
+		return;
+	}
+	if (ipc_event_subscribed(event)) {
+		ipc_state_update();
+	}
+	ipc_event_deliver(json_string, event, attrs, true);
+
+	int i;
+	for (i = 0; i < ipc_client_list->length; ++i) {
+		struct ipc_client *client = ipc_client_list->items[i];
+		if (!client->exact_events && ipc_client_wants_event(client, event, attrs)) {
+			if (pending_events->length == 0) {
+				wlc_event_source_timer_update(event_flush_timer, event_flush_delay);
+			}
+			ipc_queue_event(pending_events, json_string, event, key, attrs, false);
+			break;
+		}
 	}
 }
 
+bool ipc_event_subscribed(enum ipc_command_type event) {
+	int i;
+	for (i = 0; i < ipc_client_list->length; ++i) {
+		struct ipc_client *client = ipc_client_list->items[i];
+		if (client->subscribed_events & ipc_event_mask(event)) {
+			return true;
+		}
+	}
+	return false;
+}
+
 void ipc_event_workspace(swayc_t *old, swayc_t *new, const char *change) {
+	ipc_state_changed();
+	bool focus = strcmp("focus", change) == 0;
+	struct ipc_event_attrs attrs = { .change = change };
+	if (focus && old) {
+		attrs.workspace[0] = old->name;
+		attrs.output[0] = old->parent ? old->parent->name : NULL;
+	}
+	if (new) {
+		attrs.workspace[1] = new->name;
+		attrs.output[1] = new->parent ? new->parent->name : NULL;
+	}
+	if (!ipc_event_wanted(IPC_EVENT_WORKSPACE, &attrs)) {
+		return;
+	}
+
 	json_object *obj = json_object_new_object();
 	json_object_object_add(obj, "change", json_object_new_string(change));
-	if (strcmp("focus", change) == 0) {
+	if (focus) {
 		if (old) {
 			json_object_object_add(obj, "old", ipc_json_describe_workspace(old));
 		} else {
@@ -622,7 +2415,72 @@ void ipc_event_workspace(swayc_t *old, swayc_t *new, const char *change) {
 	}
 
 	const char *json_string = json_object_to_json_string(obj);
-	ipc_send_event(json_string, IPC_EVENT_WORKSPACE);
+	// only the latest focus change of a frame matters
+	ipc_send_event(json_string, IPC_EVENT_WORKSPACE, focus ? change : NULL, &attrs);
+
+	json_object_put(obj); // free
+}
+
+static json_object *ipc_json_rect(double x, double y, double width, double height) {
+	json_object *rect = json_object_new_object();
+	json_object_object_add(rect, "x", json_object_new_int((int32_t) x));
+	json_object_object_add(rect, "y", json_object_new_int((int32_t) y));
+	json_object_object_add(rect, "width", json_object_new_int((int32_t) width));
+	json_object_object_add(rect, "height", json_object_new_int((int32_t) height));
+	return rect;
+}
+
+// Only what the change touched is described, clients are expected to patch
+// their copy of the tree (from GET_TREE) by id.
+static json_object *ipc_json_describe_window_change(swayc_t *window, const char *change) {
+	json_object *object = json_object_new_object();
+	json_object_object_add(object, "id", json_object_new_int64((intptr_t) window));
+	bool is_new = strcmp(change, "new") == 0;
+	if (is_new || strcmp(change, "title") == 0) {
+		json_object_object_add(object, "name", window->name ? json_object_new_string(window->name) : NULL);
+	}
+	if (is_new) {
+		json_object_object_add(object, "type", json_object_new_string(swayc_type_string(window->type)));
+		json_object_object_add(object, "window", json_object_new_int64(window->handle));
+		json_object_object_add(object, "app_id", window->app_id ? json_object_new_string(window->app_id) : NULL);
+		json_object_object_add(object, "class", window->class ? json_object_new_string(window->class) : NULL);
+		json_object_object_add(object, "floating", json_object_new_boolean(window->is_floating));
+	}
+	if (is_new || strcmp(change, "move") == 0) {
+		swayc_t *ws = swayc_parent_by_type(window, C_WORKSPACE);
+		json_object_object_add(object, "parent", json_object_new_int64((intptr_t) window->parent));
+		json_object_object_add(object, "workspace", ws ? json_object_new_string(ws->name) : NULL);
+	}
+	if (strcmp(change, "geometry") == 0) {
+		const struct wlc_geometry *g = &window->last_geometry;
+		json_object_object_add(object, "rect", ipc_json_rect(g->origin.x, g->origin.y, g->size.w, g->size.h));
+	}
+	return object;
+}
+
+void ipc_event_window(swayc_t *window, const char *change) {
+	// the snapshot has the focused view and its title, not geometry
+	if (strcmp(change, "geometry") != 0) {
+		ipc_state_changed();
+	}
+	swayc_t *ws = swayc_parent_by_type(window, C_WORKSPACE);
+	swayc_t *output = swayc_parent_by_type(window, C_OUTPUT);
+	struct ipc_event_attrs attrs = {
+		.change = change,
+		.output = { output ? output->name : NULL },
+		.workspace = { ws ? ws->name : NULL },
+	};
+	if (!ipc_event_wanted(IPC_EVENT_WINDOW, &attrs)) {
+		return;
+	}
+	json_object *obj = json_object_new_object();
+	json_object_object_add(obj, "change", json_object_new_string(change));
+	// "seq" is added per client, when it's sent
+	json_object_object_add(obj, "container", ipc_json_describe_window_change(window, change));
+
+	const char *json_string = json_object_to_json_string(obj);
+	// never merged, that would leave gaps in seq
+	ipc_send_event(json_string, IPC_EVENT_WINDOW, NULL, &attrs);
 
 	json_object_put(obj); // free
 }
@@ -630,22 +2488,31 @@ void ipc_event_workspace(swayc_t *old, swayc_t *new, const char *change) {
 void ipc_event_barconfig_update(struct bar_config *bar) {
 	json_object *json = ipc_json_describe_bar_config(bar);
 	const char *json_string = json_object_to_json_string(json);
-	ipc_send_event(json_string, IPC_EVENT_BARCONFIG_UPDATE);
+	ipc_send_event(json_string, IPC_EVENT_BARCONFIG_UPDATE, bar->id, NULL);
 
 	json_object_put(json); // free
 }
 
 void ipc_event_mode(const char *mode) {
+	ipc_state_changed();
+	struct ipc_event_attrs attrs = { .change = mode };
+	if (!ipc_event_wanted(IPC_EVENT_MODE, &attrs)) {
+		return;
+	}
 	json_object *obj = json_object_new_object();
 	json_object_object_add(obj, "change", json_object_new_string(mode));
 
 	const char *json_string = json_object_to_json_string(obj);
-	ipc_send_event(json_string, IPC_EVENT_MODE);
+	ipc_send_event(json_string, IPC_EVENT_MODE, "mode", &attrs);
 
 	json_object_put(obj); // free
 }
 
 void ipc_event_modifier(uint32_t modifier, const char *state) {
+	struct ipc_event_attrs attrs = { .change = state };
+	if (!ipc_event_wanted(IPC_EVENT_MODIFIER, &attrs)) {
+		return;
+	}
 	json_object *obj = json_object_new_object();
 	json_object_object_add(obj, "change", json_object_new_string(state));
 
@@ -653,7 +2520,7 @@ void ipc_event_modifier(uint32_t modifier, const char *state) {
 	json_object_object_add(obj, "modifier", json_object_new_string(modifier_name));
 
 	const char *json_string = json_object_to_json_string(obj);
-	ipc_send_event(json_string, IPC_EVENT_MODIFIER);
+	ipc_send_event(json_string, IPC_EVENT_MODIFIER, NULL, &attrs);
 
 	json_object_put(obj); // free
 }
@@ -665,7 +2532,8 @@ static void ipc_event_binding(json_object *sb_obj) {
 	json_object_object_add(obj, "binding", sb_obj);
 
 	const char *json_string = json_object_to_json_string(obj);
-	ipc_send_event(json_string, IPC_EVENT_BINDING);
+	struct ipc_event_attrs attrs = { .change = "run" };
+	ipc_send_event(json_string, IPC_EVENT_BINDING, NULL, &attrs);
 
 	json_object_put(obj); // free
 }
@@ -673,6 +2541,9 @@ static void ipc_event_binding(json_object *sb_obj) {
 
 void ipc_event_binding_keyboard(struct sway_binding *sb) {
 #if SWAY_BINDING_EVENT
+	if (!ipc_event_subscribed(IPC_EVENT_BINDING)) {
+		return;
+	}
 	json_object *sb_obj = json_object_new_object();
 	json_object_object_add(sb_obj, "command", json_object_new_string(sb->command));
 
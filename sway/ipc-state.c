@@ -0,0 +1,223 @@
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "ipc.h"
+#include "ipc-state.h"
+#include "config.h"
+#include "container.h"
+#include "focus.h"
+#include "layout.h"
+#include "log.h"
+
+// The snapshot is built in scratch first, so the shared region is only
+// written (and seq only bumped) when something in it actually changed.
+// Readers never block sway, they retry if seq moved during their copy.
+// It's only rebuilt after the workspace, window, mode or output paths
+// flagged a change.
+static struct {
+	int fd;
+	// the same region opened read-only, this is what clients get
+	int client_fd;
+	struct ipc_state *shared;
+	size_t shared_size;
+	char *scratch;
+	size_t scratch_size;
+	bool changed;
+} state = { .fd = -1, .client_fd = -1 };
+
+static void state_string(char *dest, const char *src, size_t size) {
+	strncpy(dest, src ? src : "", size - 1);
+	dest[size - 1] = '\0';
+}
+
+static void *state_reserve(size_t size) {
+	if (size > state.scratch_size) {
+		char *scratch = realloc(state.scratch, size);
+		if (!scratch) {
+			sway_log(L_ERROR, "Unable to grow shared state snapshot");
+			return NULL;
+		}
+		state.scratch = scratch;
+		state.scratch_size = size;
+	}
+	return state.scratch;
+}
+
+static bool state_map(size_t size) {
+	if (size <= state.shared_size) {
+		return true;
+	}
+	// round up, outputs and workspaces come and go one at a time
+	size = (size + 4095) & ~(size_t)4095;
+	if (ftruncate(state.fd, size) == -1) {
+		sway_log_errno(L_ERROR, "Unable to grow shared state region");
+		return false;
+	}
+	void *shared = state.shared ?
+		mremap(state.shared, state.shared_size, size, MREMAP_MAYMOVE) :
+		mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, state.fd, 0);
+	if (shared == MAP_FAILED) {
+		sway_log_errno(L_ERROR, "Unable to map shared state region");
+		return false;
+	}
+	state.shared = shared;
+	state.shared_size = size;
+	return true;
+}
+
+static struct ipc_state *state_build(void) {
+	uint32_t outputs = 0, workspaces = 0;
+	int i, j;
+	for (i = 0; i < root_container.children->length; ++i) {
+		swayc_t *output = root_container.children->items[i];
+		++outputs;
+		workspaces += output->children->length;
+	}
+	size_t size = sizeof(struct ipc_state)
+		+ outputs * sizeof(struct ipc_state_output)
+		+ workspaces * sizeof(struct ipc_state_workspace);
+	struct ipc_state *snapshot = state_reserve(size);
+	if (!snapshot) {
+		return NULL;
+	}
+	memset(snapshot, 0, size);
+	snapshot->magic = IPC_STATE_MAGIC;
+	snapshot->version = IPC_STATE_VERSION;
+	snapshot->size = size;
+	snapshot->output_count = outputs;
+	snapshot->workspace_count = workspaces;
+	snapshot->focused_output = -1;
+	snapshot->focused_workspace = -1;
+	state_string(snapshot->mode, config->current_mode ? config->current_mode->name : NULL,
+			sizeof(snapshot->mode));
+
+	swayc_t *view = get_focused_view(&root_container);
+	if (view && view->type == C_VIEW) {
+		snapshot->focused_view = (intptr_t) view;
+		state_string(snapshot->focused_title, view->name, sizeof(snapshot->focused_title));
+	}
+
+	struct ipc_state_output *out = (struct ipc_state_output *)(snapshot + 1);
+	struct ipc_state_workspace *ws = (struct ipc_state_workspace *)(out + outputs);
+	int32_t ws_index = 0;
+	for (i = 0; i < root_container.children->length; ++i, ++out) {
+		swayc_t *output = root_container.children->items[i];
+		state_string(out->name, output->name, sizeof(out->name));
+		out->x = (int32_t) output->x;
+		out->y = (int32_t) output->y;
+		out->width = (uint32_t) output->width;
+		out->height = (uint32_t) output->height;
+		out->current_workspace = -1;
+		if (root_container.focused == output) {
+			snapshot->focused_output = i;
+		}
+		for (j = 0; j < output->children->length; ++j, ++ws, ++ws_index) {
+			swayc_t *workspace = output->children->items[j];
+			state_string(ws->name, workspace->name, sizeof(ws->name));
+			ws->num = isdigit(workspace->name[0]) ? atoi(workspace->name) : -1;
+			ws->output = i;
+			ws->x = (int32_t) workspace->x;
+			ws->y = (int32_t) workspace->y;
+			ws->width = (uint32_t) workspace->width;
+			ws->height = (uint32_t) workspace->height;
+			if (workspace->visible) {
+				ws->flags |= IPC_STATE_VISIBLE;
+			}
+			if (output->focused == workspace) {
+				out->current_workspace = ws_index;
+				if (root_container.focused == output) {
+					ws->flags |= IPC_STATE_FOCUSED;
+					snapshot->focused_workspace = ws_index;
+				}
+			}
+		}
+	}
+	return snapshot;
+}
+
+int ipc_state_fd(void) {
+	if (state.client_fd != -1) {
+		return state.client_fd;
+	}
+	state.fd = memfd_create("sway-state", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (state.fd == -1) {
+		sway_log_errno(L_ERROR, "Unable to create shared state region");
+		return -1;
+	}
+	fcntl(state.fd, F_ADD_SEALS, F_SEAL_SHRINK);
+	// Clients get an fd they can neither write, map writable, truncate nor
+	// seal through. Reopening the memfd is the only way to get one.
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", state.fd);
+	state.client_fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (state.client_fd == -1) {
+		sway_log_errno(L_ERROR, "Unable to reopen shared state region read-only");
+		ipc_state_terminate();
+		return -1;
+	}
+	struct ipc_state *snapshot = state_build();
+	if (!snapshot || !state_map(snapshot->size)) {
+		ipc_state_terminate();
+		return -1;
+	}
+	memcpy(state.shared, snapshot, snapshot->size);
+	return state.client_fd;
+}
+
+bool ipc_state_active(void) {
+	return state.shared != NULL;
+}
+
+void ipc_state_changed(void) {
+	state.changed = true;
+}
+
+void ipc_state_update(void) {
+	if (!state.shared || !state.changed) {
+		return;
+	}
+	state.changed = false;
+	struct ipc_state *snapshot = state_build();
+	if (!snapshot) {
+		return;
+	}
+	uint32_t seq = state.shared->seq;
+	snapshot->seq = seq;
+	if (snapshot->size == state.shared->size
+			&& memcmp(snapshot, state.shared, snapshot->size) == 0) {
+		return;
+	}
+	if (!state_map(snapshot->size)) {
+		return;
+	}
+	// seq goes odd before the first byte changes and even after the last
+	snapshot->seq = seq + 1;
+	__atomic_store_n(&state.shared->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(state.shared, snapshot, snapshot->size);
+	__atomic_store_n(&state.shared->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void ipc_state_terminate(void) {
+	if (state.shared) {
+		munmap(state.shared, state.shared_size);
+		state.shared = NULL;
+		state.shared_size = 0;
+	}
+	if (state.client_fd != -1) {
+		close(state.client_fd);
+		state.client_fd = -1;
+	}
+	if (state.fd != -1) {
+		close(state.fd);
+		state.fd = -1;
+	}
+	free(state.scratch);
+	state.scratch = NULL;
+	state.scratch_size = 0;
+	state.changed = false;
+}
@@ -12,6 +12,8 @@
 #include "focus.h"
 #include "output.h"
 #include "ipc-server.h"
+#include "ipc-state.h"
+#include "frame_timing.h"
 
 swayc_t root_container;
 list_t *scratchpad;
@@ -19,6 +21,8 @@ list_t *scratchpad;
 int min_sane_h = 60;
 int min_sane_w = 100;
 
+struct geometry_stats geometry_stats;
+
 void init_layout(void) {
 	root_container.type = C_ROOT;
 	root_container.layout = L_NONE;
@@ -61,6 +65,7 @@ void add_child(swayc_t *parent, swayc_t *child) {
 	if (!parent->focused) {
 		parent->focused = child;
 	}
+	layout_mark_dirty(parent);
 }
 
 void insert_child(swayc_t *parent, swayc_t *child, int index) {
@@ -75,6 +80,7 @@ void insert_child(swayc_t *parent, swayc_t *child, int index) {
 	if (!parent->focused) {
 		parent->focused = child;
 	}
+	layout_mark_dirty(parent);
 }
 
 void add_floating(swayc_t *ws, swayc_t *child) {
@@ -89,6 +95,7 @@ void add_floating(swayc_t *ws, swayc_t *child) {
 	if (!ws->focused) {
 		ws->focused = child;
 	}
+	layout_mark_dirty(child);
 }
 
 swayc_t *add_sibling(swayc_t *fixed, swayc_t *active) {
@@ -102,6 +109,7 @@ swayc_t *add_sibling(swayc_t *fixed, swayc_t *active) {
 	active->parent = parent;
 	// focus new child
 	parent->focused = active;
+	layout_mark_dirty(parent);
 	return active->parent;
 }
 
@@ -132,6 +140,7 @@ swayc_t *replace_child(swayc_t *child, swayc_t *new_child) {
 	// reset geometry for child
 	child->width = 0;
 	child->height = 0;
+	layout_mark_dirty(new_child);
 
 	// deactivate child
 	if (child->type == C_VIEW) {
@@ -171,6 +180,7 @@ swayc_t *remove_child(swayc_t *child) {
 		}
 	}
 	child->parent = NULL;
+	layout_mark_dirty(parent);
 	// deactivate view
 	if (child->type == C_VIEW) {
 		wlc_view_set_state(child->handle, WLC_BIT_ACTIVATED, false);
@@ -207,6 +217,8 @@ void swap_container(swayc_t *a, swayc_t *b) {
 	if (b_parent->focused == b && a_parent != b_parent) {
 		b_parent->focused = a;
 	}
+	layout_mark_dirty(a_parent);
+	layout_mark_dirty(b_parent);
 }
 
 void swap_geometry(swayc_t *a, swayc_t *b) {
@@ -334,6 +346,7 @@ void move_container_to(swayc_t* container, swayc_t* destination) {
 		container->width = container->height = 0;
 		add_sibling(destination, container);
 	}
+	ipc_event_window(container, "move");
 	// Destroy old container if we need to
 	parent = destroy_container(parent);
 	// Refocus
@@ -377,6 +390,11 @@ void update_geometry(swayc_t *container) {
 	if (container->type != C_VIEW) {
 		return;
 	}
+	if (container->is_floating) {
+		// Floating views are arranged here rather than by arrange_windows_r
+		container->dirty = false;
+		container->dirty_child = false;
+	}
 	swayc_t *ws = swayc_parent_by_type(container, C_WORKSPACE);
 	swayc_t *op = ws->parent;
 	int gap = container->is_floating ? 0 : swayc_gap(container);
@@ -426,11 +444,28 @@ void update_geometry(swayc_t *container) {
 			geometry.size.h = ws->y + ws->height - geometry.origin.y;
 		}
 	}
+	// Every set_geometry makes the client reconfigure, skip it when the view
+	// is already where it should be.
+	struct wlc_geometry *last = &container->last_geometry;
+	if (last->origin.x == geometry.origin.x
+			&& last->origin.y == geometry.origin.y
+			&& last->size.w == geometry.size.w
+			&& last->size.h == geometry.size.h) {
+		++geometry_stats.skipped;
+		return;
+	}
+	*last = geometry;
+	++geometry_stats.issued;
 	wlc_view_set_geometry(container->handle, 0, &geometry);
+	frame_timing_damage(op->frame_timing);
+	ipc_event_window(container, "geometry");
 }
 
 static void arrange_windows_r(swayc_t *container, double width, double height) {
 	int i;
+	// Everything below this container gets arranged now
+	container->dirty = false;
+	container->dirty_child = false;
 	if (width == -1 || height == -1) {
 		swayc_log(L_DEBUG, container, "Arranging layout for %p", container);
 		width = container->width;
@@ -455,6 +490,7 @@ static void arrange_windows_r(swayc_t *container, double width, double height) {
 		}
 		return;
 	case C_OUTPUT:
+		ipc_state_changed();
 		{
 			struct wlc_size resolution = *wlc_output_get_resolution(container->handle);
 			width = resolution.w; height = resolution.h;
@@ -475,28 +511,27 @@ static void arrange_windows_r(swayc_t *container, double width, double height) {
 		}
 		return;
 	case C_WORKSPACE:
+		ipc_state_changed();
 		{
 			swayc_t *output = swayc_parent_by_type(container, C_OUTPUT);
 			width = output->width, height = output->height;
-			for (i = 0; i < desktop_shell.panels->length; ++i) {
-				struct panel_config *config = desktop_shell.panels->items[i];
-				if (config->output == output->handle) {
-					struct wlc_size size = *wlc_surface_get_size(config->surface);
-					sway_log(L_DEBUG, "-> Found panel for this workspace: %ux%u, position: %u", size.w, size.h, config->panel_position);
-					switch (config->panel_position) {
-					case DESKTOP_SHELL_PANEL_POSITION_TOP:
-						y += size.h; height -= size.h;
-						break;
-					case DESKTOP_SHELL_PANEL_POSITION_BOTTOM:
-						height -= size.h;
-						break;
-					case DESKTOP_SHELL_PANEL_POSITION_LEFT:
-						x += size.w; width -= size.w;
-						break;
-					case DESKTOP_SHELL_PANEL_POSITION_RIGHT:
-						width -= size.w;
-						break;
-					}
+			for (i = 0; i < output->panels->length; ++i) {
+				struct panel_config *config = output->panels->items[i];
+				struct wlc_size size = config->size;
+				sway_log(L_DEBUG, "-> Found panel for this workspace: %ux%u, position: %u", size.w, size.h, config->panel_position);
+				switch (config->panel_position) {
+				case DESKTOP_SHELL_PANEL_POSITION_TOP:
+					y += size.h; height -= size.h;
+					break;
+				case DESKTOP_SHELL_PANEL_POSITION_BOTTOM:
+					height -= size.h;
+					break;
+				case DESKTOP_SHELL_PANEL_POSITION_LEFT:
+					x += size.w; width -= size.w;
+					break;
+				case DESKTOP_SHELL_PANEL_POSITION_RIGHT:
+					width -= size.w;
+					break;
 				}
 			}
 			int gap = swayc_gap(container);
@@ -611,13 +646,88 @@ static void arrange_windows_r(swayc_t *container, double width, double height) {
 	}
 }
 
+static int layout_batch_depth = 0;
+
+void layout_batch_begin(void) {
+	++layout_batch_depth;
+}
+
+void layout_batch_end(void) {
+	if (!sway_assert(layout_batch_depth > 0, "Unbalanced layout batch")) {
+		return;
+	}
+	if (--layout_batch_depth == 0) {
+		arrange_dirty_windows();
+	}
+}
+
 void arrange_windows(swayc_t *container, double width, double height) {
+	if (layout_batch_depth) {
+		// the dirty pass arranges with the container's own size, which is
+		// what every caller passes anyway
+		layout_mark_dirty(container);
+		return;
+	}
 	update_visibility(container);
 	arrange_windows_r(container, width, height);
 	layout_log(&root_container, 0);
 }
 
+void layout_mark_dirty(swayc_t *container) {
+	if (!container) {
+		return;
+	}
+	container->dirty = true;
+	// Ancestors of a container with dirty_child set are already flagged
+	swayc_t *parent = container->parent;
+	while (parent && !parent->dirty_child) {
+		parent->dirty_child = true;
+		parent = parent->parent;
+	}
+}
+
+static void arrange_dirty_windows_r(swayc_t *container) {
+	int i;
+	if (container->dirty) {
+		update_visibility(container);
+		arrange_windows_r(container, -1, -1);
+		return;
+	}
+	if (!container->dirty_child) {
+		return;
+	}
+	container->dirty_child = false;
+	if (container->children) {
+		for (i = 0; i < container->children->length; ++i) {
+			arrange_dirty_windows_r(container->children->items[i]);
+		}
+	}
+	if (container->floating) {
+		for (i = 0; i < container->floating->length; ++i) {
+			arrange_dirty_windows_r(container->floating->items[i]);
+		}
+	}
+	// Keep unmanaged views on top of whatever was just arranged
+	if (container->type == C_OUTPUT) {
+		for (i = 0; i < container->unmanaged->length; ++i) {
+			wlc_handle *handle = container->unmanaged->items[i];
+			wlc_view_bring_to_front(*handle);
+		}
+	}
+}
+
+void arrange_dirty_windows(void) {
+	if (!root_container.dirty && !root_container.dirty_child) {
+		return;
+	}
+	arrange_dirty_windows_r(&root_container);
+	layout_log(&root_container, 0);
+}
+
 swayc_t *get_swayc_in_direction_under(swayc_t *container, enum movement_direction dir, swayc_t *limit) {
+	// directions are resolved by position, which a batch may not have
+	// updated yet
+	arrange_dirty_windows();
 	swayc_t *parent = container->parent;
 	if (dir == MOVE_PARENT) {
 		if (parent->type == C_OUTPUT) {
@@ -61,10 +61,7 @@ void bar_setup(struct bar *bar, const char *socket_path, const char *bar_id, int
 	}
 
 	/* connect to sway ipc */
-	bar->ipc_socketfd = ipc_open_socket(socket_path);
-	bar->ipc_event_socketfd = ipc_open_socket(socket_path);
-
-	ipc_bar_init(bar, desired_output, bar_id);
+	ipc_bar_init(bar, ipc_open_socket(socket_path), desired_output, bar_id);
 
 	struct output_state *output = bar->output->registry->outputs->items[desired_output];
 
@@ -86,7 +83,7 @@ void bar_setup(struct bar *bar, const char *socket_path, const char *bar_id, int
 }
 
 void bar_run(struct bar *bar) {
-	fd_set readfds;
+	fd_set readfds, writefds;
 	int activity;
 	bool dirty = true;
 
@@ -104,15 +101,23 @@ void bar_run(struct bar *bar) {
 
 		dirty = false;
 		FD_ZERO(&readfds);
-		FD_SET(bar->ipc_event_socketfd, &readfds);
+		FD_ZERO(&writefds);
+		FD_SET(bar->ipc->fd, &readfds);
+		if (bar->ipc->write_len) {
+			FD_SET(bar->ipc->fd, &writefds);
+		}
 		FD_SET(bar->status_read_fd, &readfds);
 
-		activity = select(FD_SETSIZE, &readfds, NULL, NULL, NULL);
+		activity = select(FD_SETSIZE, &readfds, &writefds, NULL, NULL);
 		if (activity < 0) {
 			sway_log(L_ERROR, "polling failed: %d", errno);
 		}
 
-		if (FD_ISSET(bar->ipc_event_socketfd, &readfds)) {
+		if (FD_ISSET(bar->ipc->fd, &writefds)) {
+			ipc_connection_flush(bar->ipc);
+		}
+
+		if (FD_ISSET(bar->ipc->fd, &readfds)) {
 			sway_log(L_DEBUG, "Got IPC event.");
 			dirty = handle_ipc_event(bar);
 		}
@@ -172,12 +177,8 @@ void bar_teardown(struct bar *bar) {
 		close(bar->status_read_fd);
 	}
 
-	if (bar->ipc_socketfd) {
-		close(bar->ipc_socketfd);
-	}
-
-	if (bar->ipc_event_socketfd) {
-		close(bar->ipc_event_socketfd);
+	if (bar->ipc) {
+		ipc_connection_destroy(bar->ipc);
 	}
 
 	/* terminate status command process */
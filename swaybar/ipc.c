@@ -1,6 +1,8 @@
+#include <stdlib.h>
 #include <string.h>
 #include <json-c/json.h>
 
+#include "cbor.h"
 #include "ipc-client.h"
 #include "list.h"
 #include "log.h"
@@ -150,52 +152,210 @@ static void ipc_parse_config(struct config *config, const char *payload) {
 	json_object_put(bar_config);
 }
 
-static void ipc_update_workspaces(struct bar *bar) {
+// set by the handlers when something the bar shows changed
+static bool ipc_dirty = false;
+// a workspace event came in while GET_WORKSPACES was on its way, the reply
+// might already be outdated
+static bool workspaces_requested = false, workspaces_stale = false;
+
+static void ipc_request_workspaces(struct bar *bar);
+
+// Reads the next entry of an array or map, remaining starts out as its
+// length. For maps this reads the key, the value is the item after it.
+// Returns false at the end or if the data is bad.
+static bool cbor_next(struct cbor_reader *reader, size_t *remaining, struct cbor_item *item) {
+	if (*remaining != CBOR_INDEFINITE) {
+		if (*remaining == 0) {
+			return false;
+		}
+		--*remaining;
+	}
+	return cbor_read(reader, item) && item->type != CBOR_BREAK;
+}
+
+// Reads the value of key in the map payload is made of.
+static bool cbor_map_get(const struct ipc_response *resp, const char *key, struct cbor_item *value) {
+	struct cbor_reader reader;
+	struct cbor_item map, name;
+	cbor_reader_init(&reader, resp->payload, resp->size);
+	if (!cbor_read(&reader, &map) || map.type != CBOR_MAP) {
+		return false;
+	}
+	size_t remaining = map.length;
+	while (cbor_next(&reader, &remaining, &name) && cbor_read(&reader, value)) {
+		if (cbor_string_equal(&name, key)) {
+			return true;
+		}
+		if (!cbor_skip(&reader, value)) {
+			return false;
+		}
+	}
+	return false;
+}
+
+static void ipc_update_workspaces(struct ipc_response *resp, void *data) {
+	struct bar *bar = data;
+	workspaces_requested = false;
+	if (workspaces_stale) {
+		workspaces_stale = false;
+		ipc_request_workspaces(bar);
+		return;
+	}
+
+	struct cbor_reader reader;
+	struct cbor_item results, entry;
+	cbor_reader_init(&reader, resp->payload, resp->size);
+	if (!cbor_read(&reader, &results) || results.type != CBOR_ARRAY) {
+		sway_log(L_ERROR, "failed to parse workspaces");
+		return;
+	}
+
 	if (bar->output->workspaces) {
 		free_workspaces(bar->output->workspaces);
 	}
 	bar->output->workspaces = create_list();
 
-	uint32_t len = 0;
-	char *res = ipc_single_command(bar->ipc_socketfd, IPC_GET_WORKSPACES, NULL, &len);
-	json_object *results = json_tokener_parse(res);
-	if (!results) {
-		free(res);
+	size_t remaining = results.length;
+	while (cbor_next(&reader, &remaining, &entry)) {
+		if (entry.type != CBOR_MAP) {
+			cbor_skip(&reader, &entry);
+			continue;
+		}
+		struct workspace *ws = calloc(1, sizeof(struct workspace));
+		bool on_output = false;
+		size_t fields = entry.length;
+		struct cbor_item key, value;
+		while (cbor_next(&reader, &fields, &key) && cbor_read(&reader, &value)) {
+			if (cbor_string_equal(&key, "num") && value.type == CBOR_INTEGER) {
+				ws->num = (int)value.integer;
+			} else if (cbor_string_equal(&key, "name") && value.type == CBOR_STRING) {
+				free(ws->name);
+				ws->name = strndup(value.string, value.length);
+			} else if (cbor_string_equal(&key, "visible") && value.type == CBOR_BOOLEAN) {
+				ws->visible = value.boolean;
+			} else if (cbor_string_equal(&key, "focused") && value.type == CBOR_BOOLEAN) {
+				ws->focused = value.boolean;
+			} else if (cbor_string_equal(&key, "urgent") && value.type == CBOR_BOOLEAN) {
+				ws->urgent = value.boolean;
+			} else if (cbor_string_equal(&key, "output")) {
+				on_output = cbor_string_equal(&value, bar->output->name);
+			} else {
+				cbor_skip(&reader, &value);
+			}
+		}
+		if (on_output && ws->name) {
+			list_add(bar->output->workspaces, ws);
+		} else {
+			free(ws->name);
+			free(ws);
+		}
+	}
+
+	ipc_dirty = true;
+}
+
+// Workspaces are read from sway's shared state once it was handed out,
+// workspace events then don't need a request each.
+static struct ipc_state_map *state_map = NULL;
+
+static void ipc_read_workspaces(struct bar *bar) {
+	if (!ipc_state_map_read(state_map)) {
 		return;
 	}
+	if (bar->output->workspaces) {
+		free_workspaces(bar->output->workspaces);
+	}
+	bar->output->workspaces = create_list();
 
-	int i;
-	int length = json_object_array_length(results);
-	json_object *ws_json;
-	json_object *num, *name, *visible, *focused, *out, *urgent;
-	for (i = 0; i < length; ++i) {
-		ws_json = json_object_array_get_idx(results, i);
-
-		json_object_object_get_ex(ws_json, "num", &num);
-		json_object_object_get_ex(ws_json, "name", &name);
-		json_object_object_get_ex(ws_json, "visible", &visible);
-		json_object_object_get_ex(ws_json, "focused", &focused);
-		json_object_object_get_ex(ws_json, "output", &out);
-		json_object_object_get_ex(ws_json, "urgent", &urgent);
-
-		if (strcmp(json_object_get_string(out), bar->output->name) == 0) {
-			struct workspace *ws = malloc(sizeof(struct workspace));
-			ws->num = json_object_get_int(num);
-			ws->name = strdup(json_object_get_string(name));
-			ws->visible = json_object_get_boolean(visible);
-			ws->focused = json_object_get_boolean(focused);
-			ws->urgent = json_object_get_boolean(urgent);
-			list_add(bar->output->workspaces, ws);
+	const struct ipc_state *snapshot = state_map->snapshot;
+	const struct ipc_state_output *outputs = (const struct ipc_state_output *)(snapshot + 1);
+	const struct ipc_state_workspace *ws_state =
+		(const struct ipc_state_workspace *)(outputs + snapshot->output_count);
+	uint32_t i;
+	for (i = 0; i < snapshot->workspace_count; ++i, ++ws_state) {
+		if (strcmp(outputs[ws_state->output].name, bar->output->name) != 0) {
+			continue;
 		}
+		struct workspace *ws = malloc(sizeof(struct workspace));
+		ws->num = ws_state->num;
+		ws->name = strdup(ws_state->name);
+		ws->visible = ws_state->flags & IPC_STATE_VISIBLE;
+		ws->focused = ws_state->flags & IPC_STATE_FOCUSED;
+		ws->urgent = ws_state->flags & IPC_STATE_URGENT;
+		list_add(bar->output->workspaces, ws);
 	}
+	ipc_dirty = true;
+}
 
-	json_object_put(results);
-	free(res);
+static void ipc_handle_state(struct ipc_response *resp, void *data) {
+	struct bar *bar = data;
+	struct cbor_item success;
+	if (cbor_map_get(resp, "success", &success)
+			&& success.type == CBOR_BOOLEAN && success.boolean) {
+		int fd = ipc_connection_take_fd(bar->ipc);
+		if (fd != -1) {
+			state_map = ipc_state_map_create(fd);
+		}
+	}
+	if (!state_map) {
+		sway_log(L_INFO, "No shared state from sway, falling back to GET_WORKSPACES");
+	}
 }
 
-void ipc_bar_init(struct bar *bar, int outputi, const char *bar_id) {
+static void ipc_request_workspaces(struct bar *bar) {
+	if (state_map) {
+		ipc_read_workspaces(bar);
+		return;
+	}
+	if (workspaces_requested) {
+		workspaces_stale = true;
+		return;
+	}
+	workspaces_requested = true;
+	ipc_connection_submit(bar->ipc, IPC_GET_WORKSPACES, NULL, 0, ipc_update_workspaces, bar);
+}
+
+static void ipc_handle_event(struct ipc_response *resp, void *data) {
+	struct bar *bar = data;
+	switch (resp->type) {
+	case IPC_EVENT_WORKSPACE:
+		ipc_request_workspaces(bar);
+		break;
+	case IPC_EVENT_MODE: {
+		struct cbor_item change;
+		if (!cbor_map_get(resp, "change", &change) || change.type != CBOR_STRING) {
+			sway_log(L_ERROR, "failed to parse response");
+			return;
+		}
+		free(bar->config->mode);
+		if (cbor_string_equal(&change, "default")) {
+			bar->config->mode = NULL;
+		} else {
+			bar->config->mode = strndup(change.string, change.length);
+		}
+		ipc_dirty = true;
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+// The reply to SET_ENCODING is the last one in JSON, replies and events after
+// it are CBOR and read in place.
+static void ipc_handle_encoding(struct ipc_response *resp, void *data) {
+	json_object *result = json_tokener_parse(resp->payload);
+	json_object *success;
+	if (!result || !json_object_object_get_ex(result, "success", &success)
+			|| !json_object_get_boolean(success)) {
+		sway_abort("sway refused to switch IPC to CBOR");
+	}
+	json_object_put(result);
+}
+
+void ipc_bar_init(struct bar *bar, int socketfd, int outputi, const char *bar_id) {
 	uint32_t len = 0;
-	char *res = ipc_single_command(bar->ipc_socketfd, IPC_GET_OUTPUTS, NULL, &len);
+	char *res = ipc_single_command(socketfd, IPC_GET_OUTPUTS, NULL, &len);
 	json_object *outputs = json_tokener_parse(res);
 	json_object *info = json_object_array_get_idx(outputs, outputi);
 	json_object *name;
@@ -205,54 +365,37 @@ void ipc_bar_init(struct bar *bar, int outputi, const char *bar_id) {
 	json_object_put(outputs);
 
 	len = strlen(bar_id);
-	res = ipc_single_command(bar->ipc_socketfd, IPC_GET_BAR_CONFIG, bar_id, &len);
+	res = ipc_single_command(socketfd, IPC_GET_BAR_CONFIG, bar_id, &len);
 
 	ipc_parse_config(bar->config, res);
 	free(res);
 
-	const char *subscribe_json = "[ \"workspace\", \"mode\" ]";
-	len = strlen(subscribe_json);
-	res = ipc_single_command(bar->ipc_event_socketfd, IPC_SUBSCRIBE, subscribe_json, &len);
-	free(res);
-
-	ipc_update_workspaces(bar);
+	// from here on nothing waits for sway
+	bar->ipc = ipc_connection_create(socketfd);
+	if (!bar->ipc) {
+		sway_abort("Unable to set up IPC connection");
+	}
+	ipc_connection_set_event_handler(bar->ipc, ipc_handle_event, bar);
+	// events and replies are smaller and read without building json objects
+	ipc_connection_submit(bar->ipc, IPC_SWAY_SET_ENCODING, "cbor", 4, ipc_handle_encoding, NULL);
+	// only workspace events that concern this bar's output wake it up
+	json_object *subscribe = json_object_new_array();
+	json_object *workspace_filter = json_object_new_object();
+	json_object_object_add(workspace_filter, "event", json_object_new_string("workspace"));
+	json_object_object_add(workspace_filter, "output", json_object_new_string(bar->output->name));
+	json_object_array_add(subscribe, workspace_filter);
+	json_object_array_add(subscribe, json_object_new_string("mode"));
+	const char *subscribe_json = json_object_to_json_string(subscribe);
+	ipc_connection_submit(bar->ipc, IPC_SUBSCRIBE, subscribe_json, strlen(subscribe_json), NULL, NULL);
+	json_object_put(subscribe);
+	ipc_request_workspaces(bar);
+	ipc_connection_submit(bar->ipc, IPC_SWAY_GET_STATE_SHM, NULL, 0, ipc_handle_state, bar);
 }
 
 bool handle_ipc_event(struct bar *bar) {
-	struct ipc_response *resp = ipc_recv_response(bar->ipc_event_socketfd);
-	switch (resp->type) {
-	case IPC_EVENT_WORKSPACE:
-		ipc_update_workspaces(bar);
-		break;
-	case IPC_EVENT_MODE: {
-		json_object *result = json_tokener_parse(resp->payload);
-		if (!result) {
-			free_ipc_response(resp);
-			sway_log(L_ERROR, "failed to parse payload as json");
-			return false;
-		}
-		json_object *json_change;
-		if (json_object_object_get_ex(result, "change", &json_change)) {
-			const char *change = json_object_get_string(json_change);
-
-			free(bar->config->mode);
-			if (strcmp(change, "default") == 0) {
-				bar->config->mode = NULL;
-			} else {
-				bar->config->mode = strdup(change);
-			}
-		} else {
-			sway_log(L_ERROR, "failed to parse response");
-		}
-
-		json_object_put(result);
-		break;
+	ipc_dirty = false;
+	if (!ipc_connection_dispatch(bar->ipc)) {
+		sway_abort("Lost the IPC connection to sway");
 	}
-	default:
-		free_ipc_response(resp);
-		return false;
-	}
-
-	free_ipc_response(resp);
-	return true;
+	return ipc_dirty;
 }
@@ -6,6 +6,11 @@
 #include <stdint.h>
 #include <math.h>
 #include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <sys/mman.h>
 #include <json-c/json.h>
 #include "log.h"
 #include "ipc-client.h"
@@ -15,100 +20,301 @@ void sway_terminate(void) {
 	exit(EXIT_FAILURE);
 }
 
-void grab_and_apply_magick(const char *file, const char *output,
-		int socketfd, int raw) {
-	uint32_t len = strlen(output);
-	char *pixels = ipc_single_command(socketfd,
-			IPC_SWAY_GET_PIXELS, output, &len);
-	uint32_t *u32pixels = (uint32_t *)(pixels + 1);
+// The frame sway last copied into the shared buffer it passed us.
+struct frame {
+	int fd;
+	char *pixels;
+	size_t size;
+	uint32_t width, height;
+	// false if sway found nothing changed since the last frame
+	bool changed;
+};
+
+// With delta, sway only updates the tiles of the shared buffer that changed.
+void grab_frame(const char *output, int socketfd, struct frame *frame, bool delta) {
+	// sway flips the rows for us
+	json_object *request = json_object_new_object();
+	json_object_object_add(request, "output", json_object_new_string(output));
+	json_object_object_add(request, "top_down", json_object_new_boolean(true));
+	json_object_object_add(request, "delta", json_object_new_boolean(delta));
+	const char *payload = json_object_to_json_string(request);
+	ipc_send_command(socketfd, IPC_SWAY_GET_PIXELS_SHM, payload, strlen(payload));
+	json_object_put(request);
+	struct ipc_response *resp = ipc_recv_response(socketfd);
+	uint8_t flags = resp->payload[0];
+	uint32_t *u32pixels = (uint32_t *)(resp->payload + 1);
 	uint32_t width = u32pixels[0];
 	uint32_t height = u32pixels[1];
-	len -= 9;
-	pixels += 9;
+	if (!(flags & IPC_PIXELS_DONE) || width == 0 || height == 0) {
+		sway_abort("Unable to grab output %s.", output);
+	}
 
-	if (width == 0 || height == 0) {
-		sway_abort("Unknown output %s.", output);
+	if (flags & IPC_PIXELS_NEW_BUFFER) {
+		if (resp->fd == -1) {
+			sway_abort("sway didn't pass the pixel buffer.");
+		}
+		if (frame->pixels) {
+			munmap(frame->pixels, frame->size);
+			close(frame->fd);
+		}
+		frame->size = width * height * 4;
+		frame->fd = resp->fd;
+		resp->fd = -1;
+		frame->pixels = mmap(NULL, frame->size, PROT_READ, MAP_SHARED, frame->fd, 0);
+		if (frame->pixels == MAP_FAILED) {
+			sway_abort("Unable to map pixel buffer.");
+		}
 	}
+	frame->width = width;
+	frame->height = height;
+	// the tiles themselves don't matter, the buffer holds the whole frame
+	frame->changed = !(flags & IPC_PIXELS_DELTA) || u32pixels[2] > 0;
+	free_ipc_response(resp);
+}
+
+void release_frame(struct frame *frame) {
+	if (frame->pixels) {
+		munmap(frame->pixels, frame->size);
+		close(frame->fd);
+	}
+}
+
+void grab_and_apply_magick(const char *file, const char *output,
+		int socketfd, int raw) {
+	struct frame frame = { .fd = -1 };
+	grab_frame(output, socketfd, &frame, false);
 
 	if (raw) {
-		fwrite(pixels, 1, len, stdout);
+		fwrite(frame.pixels, 1, frame.size, stdout);
 		fflush(stdout);
-		free(pixels - 9);
+		release_frame(&frame);
 		return;
 	}
 
-	const char *fmt = "convert -depth 8 -size %dx%d+0 rgba:- -flip %s";
+	const char *fmt = "convert -depth 8 -size %dx%d+0 rgba:- %s";
 	char *cmd = malloc(strlen(fmt) - 6 /*args*/
-			+ numlen(width) + numlen(height) + strlen(file) + 1);
-	sprintf(cmd, fmt, width, height, file);
+			+ numlen(frame.width) + numlen(frame.height) + strlen(file) + 1);
+	sprintf(cmd, fmt, frame.width, frame.height, file);
 
 	FILE *f = popen(cmd, "w");
-	fwrite(pixels, 1, len, f);
+	fwrite(frame.pixels, 1, frame.size, f);
 	fflush(f);
 	fclose(f);
-	free(pixels - 9);
+	release_frame(&frame);
 	free(cmd);
 }
 
+// Frames waiting for the writer. Capturing and writing run in their own
+// threads, so a slow encoder doesn't push the next capture late.
+#define FRAME_QUEUE_SIZE 4
+
+struct frame_queue {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	// ring of FRAME_QUEUE_SIZE buffers, length of them filled from start
+	char *frames[FRAME_QUEUE_SIZE];
+	// the capture tick each frame belongs to
+	uint64_t ticks[FRAME_QUEUE_SIZE];
+	int start, length;
+	bool done;
+	// set with done, the writer repeats the last frame up to this tick
+	uint64_t end_tick;
+};
+
+struct capture {
+	const char *output;
+	int socketfd;
+	int framerate;
+	struct frame frame;
+	struct frame_queue queue;
+	FILE *out;
+	// frames the queue had no room for, frames sway found no changes in,
+	// and frames written again to fill the gaps both leave
+	uint64_t captured, dropped, unchanged, duplicated;
+};
+
+static volatile sig_atomic_t capturing = 1;
+
+static void stop_capture(int signal) {
+	capturing = 0;
+}
+
+static void timespec_add_ns(struct timespec *ts, long ns) {
+	ts->tv_nsec += ns;
+	while (ts->tv_nsec >= 1000000000) {
+		ts->tv_nsec -= 1000000000;
+		++ts->tv_sec;
+	}
+}
+
+static void *capture_thread(void *data) {
+	struct capture *capture = data;
+	struct frame_queue *queue = &capture->queue;
+	long ns = (long)(1000000000 * (1.0 / capture->framerate));
+	uint32_t width = capture->frame.width;
+	uint32_t height = capture->frame.height;
+
+	struct timespec next, now;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	uint64_t tick = 0, last_tick = 0;
+	// the writer is missing changes of a dropped frame
+	bool behind = false;
+	while (capturing) {
+		grab_frame(capture->output, capture->socketfd, &capture->frame, true);
+		if (capture->frame.width != width || capture->frame.height != height) {
+			sway_log(L_ERROR, "Output %s changed size, stopping capture.", capture->output);
+			break;
+		}
+		++capture->captured;
+		last_tick = tick;
+
+		pthread_mutex_lock(&queue->lock);
+		if (!capture->frame.changed && tick > 0 && !behind) {
+			// the writer repeats the last frame anyway
+			++capture->unchanged;
+		} else if (queue->length == FRAME_QUEUE_SIZE) {
+			++capture->dropped;
+			behind = true;
+		} else {
+			behind = false;
+			int i = (queue->start + queue->length) % FRAME_QUEUE_SIZE;
+			memcpy(queue->frames[i], capture->frame.pixels, capture->frame.size);
+			queue->ticks[i] = tick;
+			++queue->length;
+			pthread_cond_signal(&queue->cond);
+		}
+		pthread_mutex_unlock(&queue->lock);
+
+		// stay on the schedule, skipping the ticks a slow capture missed
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		do {
+			timespec_add_ns(&next, ns);
+			++tick;
+		} while (next.tv_sec < now.tv_sec
+				|| (next.tv_sec == now.tv_sec && next.tv_nsec < now.tv_nsec));
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+	}
+
+	pthread_mutex_lock(&queue->lock);
+	queue->done = true;
+	queue->end_tick = last_tick;
+	pthread_cond_signal(&queue->cond);
+	pthread_mutex_unlock(&queue->lock);
+	return NULL;
+}
+
+static void *writer_thread(void *data) {
+	struct capture *capture = data;
+	struct frame_queue *queue = &capture->queue;
+	size_t size = capture->frame.size;
+	// the frame written last, swapped with the queue's buffers
+	char *last = malloc(size);
+	uint64_t last_tick = 0;
+	bool first = true;
+
+	pthread_mutex_lock(&queue->lock);
+	while (true) {
+		while (queue->length == 0 && !queue->done) {
+			pthread_cond_wait(&queue->cond, &queue->lock);
+		}
+		if (queue->length == 0) {
+			break;
+		}
+		int i = queue->start;
+		char *pixels = queue->frames[i];
+		queue->frames[i] = last;
+		last = pixels;
+		uint64_t tick = queue->ticks[i];
+		queue->start = (queue->start + 1) % FRAME_QUEUE_SIZE;
+		--queue->length;
+		pthread_mutex_unlock(&queue->lock);
+
+		// rawvideo has no timestamps, repeat a frame for every tick
+		// without one to keep the timing
+		uint64_t count = first ? 1 : tick - last_tick;
+		capture->duplicated += count - 1;
+		while (count--) {
+			fwrite(last, 1, size, capture->out);
+		}
+		last_tick = tick;
+		first = false;
+
+		pthread_mutex_lock(&queue->lock);
+	}
+	uint64_t end_tick = queue->end_tick;
+	pthread_mutex_unlock(&queue->lock);
+	// unchanged frames at the end have nothing after them to fill them in
+	if (!first && end_tick > last_tick) {
+		capture->duplicated += end_tick - last_tick;
+		for (; last_tick < end_tick; ++last_tick) {
+			fwrite(last, 1, size, capture->out);
+		}
+	}
+	fflush(capture->out);
+	free(last);
+	return NULL;
+}
+
 void grab_and_apply_movie_magic(const char *file, const char *output,
 		int socketfd, int raw, int framerate) {
+	struct capture capture = {
+		.output = output,
+		.socketfd = socketfd,
+		.framerate = framerate,
+		.frame = { .fd = -1 },
+	};
+	grab_frame(output, socketfd, &capture.frame, false);
+	uint32_t width = capture.frame.width;
+	uint32_t height = capture.frame.height;
+
+	char *cmd = NULL;
 	if (raw) {
-		sway_log(L_ERROR, "Raw capture data is not yet supported. Proceeding with ffmpeg normally.");
+		capture.out = stdout;
+	} else {
+		const char *fmt = "ffmpeg -f rawvideo -framerate %d "
+			"-video_size %dx%d -pixel_format argb "
+			"-i pipe:0 -r %d %s";
+		cmd = malloc(strlen(fmt) - 8 /*args*/
+				+ numlen(width) + numlen(height) + numlen(framerate) * 2
+				+ strlen(file) + 1);
+		sprintf(cmd, fmt, framerate, width, height, framerate, file);
+		capture.out = popen(cmd, "w");
+		if (!capture.out) {
+			sway_abort("Unable to run ffmpeg.");
+		}
 	}
 
-	uint32_t len = strlen(output);
-	char *pixels = ipc_single_command(socketfd,
-			IPC_SWAY_GET_PIXELS, output, &len);
-	uint32_t *u32pixels = (uint32_t *)(pixels + 1);
-	uint32_t width = u32pixels[0];
-	uint32_t height = u32pixels[1];
-	pixels += 9;
-
-	if (width == 0 || height == 0) {
-		sway_abort("Unknown output %s.", output);
+	struct frame_queue *queue = &capture.queue;
+	pthread_mutex_init(&queue->lock, NULL);
+	pthread_cond_init(&queue->cond, NULL);
+	int i;
+	for (i = 0; i < FRAME_QUEUE_SIZE; ++i) {
+		queue->frames[i] = malloc(capture.frame.size);
 	}
 
-	const char *fmt = "ffmpeg -f rawvideo -framerate %d "
-		"-video_size %dx%d -pixel_format argb "
-		"-i pipe:0 -r %d -vf vflip %s";
-	char *cmd = malloc(strlen(fmt) - 8 /*args*/
-			+ numlen(width) + numlen(height) + numlen(framerate) * 2
-			+ strlen(file) + 1);
-	sprintf(cmd, fmt, framerate, width, height, framerate, file);
+	// stop cleanly so ffmpeg gets to finish the file
+	signal(SIGINT, stop_capture);
+	signal(SIGTERM, stop_capture);
 
-	long ns = (long)(1000000000 * (1.0 / framerate));
-	struct timespec start, finish, ts;
-	ts.tv_sec = 0;
+	pthread_t capturer, writer;
+	pthread_create(&writer, NULL, writer_thread, &capture);
+	pthread_create(&capturer, NULL, capture_thread, &capture);
+	pthread_join(capturer, NULL);
+	pthread_join(writer, NULL);
 
-	FILE *f = popen(cmd, "w");
-	fwrite(pixels, 1, len, f);
-	free(pixels - 9);
-	int sleep = 0;
-	while (sleep != -1) {
-		clock_gettime(CLOCK_MONOTONIC, &start);
-		len = strlen(output);
-		pixels = ipc_single_command(socketfd,
-				IPC_SWAY_GET_PIXELS, output, &len);
-		pixels += 9;
-		len -= 9;
-
-		fwrite(pixels, 1, len, f);
-
-		free(pixels - 9);
-		clock_gettime(CLOCK_MONOTONIC, &finish);
-		ts.tv_nsec = ns;
-		double fts = (double)finish.tv_sec + 1.0e-9*finish.tv_nsec;
-		double sts = (double)start.tv_sec + 1.0e-9*start.tv_nsec;
-		long diff = (fts - sts) * 1000000000;
-		ts.tv_nsec = ns - diff;
-		if (ts.tv_nsec < 0) {
-			ts.tv_nsec = 0;
-		}
-		sleep = nanosleep(&ts, NULL);
-	}
-	fflush(f);
+	sway_log(L_INFO, "Captured %" PRIu64 " frames (%" PRIu64 " unchanged), "
+			"dropped %" PRIu64 ", duplicated %" PRIu64 ".",
+			capture.captured, capture.unchanged, capture.dropped, capture.duplicated);
 
-	fclose(f);
+	for (i = 0; i < FRAME_QUEUE_SIZE; ++i) {
+		free(queue->frames[i]);
+	}
+	pthread_cond_destroy(&queue->cond);
+	pthread_mutex_destroy(&queue->lock);
+	if (!raw) {
+		pclose(capture.out);
+	}
+	release_frame(&capture.frame);
 	free(cmd);
 }
 
@@ -182,7 +388,7 @@ int main(int argc, char **argv) {
 	int c;
 	while (1) {
 		int option_index = 0;
-		c = getopt_long(argc, argv, "hco:vs:r", long_options, &option_index);
+		c = getopt_long(argc, argv, "hco:vs:rR:", long_options, &option_index);
 		if (c == -1) {
 			break;
 		}
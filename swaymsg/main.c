@@ -3,9 +3,11 @@
 #include <string.h>
 #include <getopt.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <sys/un.h>
 #include <sys/socket.h>
 #include <unistd.h>
+#include <time.h>
 #include "stringop.h"
 #include "ipc-client.h"
 #include "readline.h"
@@ -15,10 +17,65 @@ void sway_terminate(void) {
 	exit(EXIT_FAILURE);
 }
 
+// Requests sent ahead of their replies in --file mode.
+#define PIPELINE_DEPTH 64
+
+static double now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// Sends every line of file as a message of the given type over one
+// connection. Requests don't wait for the reply of the one before, replies
+// are printed in order. Events are skipped.
+static void run_file(int socketfd, uint32_t type, FILE *file, int quiet, int latency) {
+	struct {
+		char *line;
+		double sent;
+	} pending[PIPELINE_DEPTH];
+	int start = 0, length = 0;
+	bool eof = false;
+	while (!eof || length) {
+		if (!eof && length < PIPELINE_DEPTH) {
+			char *line = read_line(file);
+			if (!line || feof(file)) {
+				eof = true;
+			}
+			if (!line || !*line || *line == '#') {
+				free(line);
+				continue;
+			}
+			int i = (start + length++) % PIPELINE_DEPTH;
+			pending[i].line = line;
+			pending[i].sent = now_ms();
+			ipc_send_command(socketfd, type, line, strlen(line));
+			continue;
+		}
+		struct ipc_response *resp = ipc_recv_response(socketfd);
+		if (resp->type & (1u << 31)) {
+			// events are no reply to any of the lines, don't pair them with one
+			free_ipc_response(resp);
+			continue;
+		}
+		if (latency) {
+			fprintf(stderr, "%.3f ms\t%s\n", now_ms() - pending[start].sent, pending[start].line);
+		}
+		if (!quiet) {
+			printf("%s\n", resp->payload);
+		}
+		free_ipc_response(resp);
+		free(pending[start].line);
+		start = (start + 1) % PIPELINE_DEPTH;
+		--length;
+	}
+}
+
 int main(int argc, char **argv) {
-	static int quiet = 0;
+	static int quiet = 0, latency = 0;
 	char *socket_path = NULL;
 	char *cmdtype = NULL;
+	char *file = NULL;
 
 	init_log(L_INFO);
 
@@ -28,6 +85,8 @@ int main(int argc, char **argv) {
 		{"version", no_argument, NULL, 'v'},
 		{"socket", required_argument, NULL, 's'},
 		{"type", required_argument, NULL, 't'},
+		{"file", required_argument, NULL, 'f'},
+		{"latency", no_argument, NULL, 'l'},
 		{0, 0, 0, 0}
 	};
 
@@ -38,12 +97,14 @@ int main(int argc, char **argv) {
 		"  -q, --quiet            Be quiet.\n"
 		"  -v, --version          Show the version number and quit.\n"
 		"  -s, --socket <socket>  Use the specified socket.\n"
-		"  -t, --type <type>      Specify the message type.\n";
+		"  -t, --type <type>      Specify the message type.\n"
+		"  -f, --file <file>      Send each line of file (- for stdin) as a message.\n"
+		"  -l, --latency          Print how long each reply took to stderr.\n";
 
 	int c;
 	while (1) {
 		int option_index = 0;
-		c = getopt_long(argc, argv, "hqvs:t:", long_options, &option_index);
+		c = getopt_long(argc, argv, "hqvs:t:f:l", long_options, &option_index);
 		if (c == -1) {
 			break;
 		}
@@ -57,6 +118,12 @@ int main(int argc, char **argv) {
 		case 't': // Type
 			cmdtype = strdup(optarg);
 			break;
+		case 'f': // File
+			file = strdup(optarg);
+			break;
+		case 'l': // Latency
+			latency = 1;
+			break;
 		case 'v':
 #if defined SWAY_GIT_VERSION && defined SWAY_GIT_BRANCH && defined SWAY_VERSION_DATE
 			fprintf(stdout, "sway version %s (%s, branch \"%s\")\n", SWAY_GIT_VERSION, SWAY_VERSION_DATE, SWAY_GIT_BRANCH);
@@ -99,11 +166,36 @@ int main(int argc, char **argv) {
 		type = IPC_GET_BAR_CONFIG;
 	} else if (strcasecmp(cmdtype, "get_version") == 0) {
 		type = IPC_GET_VERSION;
+	} else if (strcasecmp(cmdtype, "get_geometry_stats") == 0) {
+		type = IPC_SWAY_GET_GEOMETRY_STATS;
+	} else if (strcasecmp(cmdtype, "get_frame_stats") == 0) {
+		type = IPC_SWAY_GET_FRAME_STATS;
+	} else if (strcasecmp(cmdtype, "command_batch") == 0) {
+		type = IPC_SWAY_COMMAND_BATCH;
+	} else if (strcasecmp(cmdtype, "get_ipc_stats") == 0
+			|| strcasecmp(cmdtype, "get_stats") == 0) {
+		type = IPC_SWAY_GET_IPC_STATS;
 	} else {
 		sway_abort("Unknown message type %s", cmdtype);
 	}
 	free(cmdtype);
 
+	if (file) {
+		FILE *f = strcmp(file, "-") == 0 ? stdin : fopen(file, "r");
+		if (!f) {
+			sway_abort("Unable to open %s", file);
+		}
+		int socketfd = ipc_open_socket(socket_path);
+		run_file(socketfd, type, f, quiet, latency);
+		close(socketfd);
+		if (f != stdin) {
+			fclose(f);
+		}
+		free(file);
+		free(socket_path);
+		return 0;
+	}
+
 	char *command = strdup("");
 	if (optind < argc) {
 		command = join_args(argv + optind, argc - optind);
@@ -111,7 +203,11 @@ int main(int argc, char **argv) {
 
 	int socketfd = ipc_open_socket(socket_path);
 	uint32_t len = strlen(command);
+	double sent = now_ms();
 	char *resp = ipc_single_command(socketfd, type, command, &len);
+	if (latency) {
+		fprintf(stderr, "%.3f ms\n", now_ms() - sent);
+	}
 	if (!quiet) {
 		printf("%s\n", resp);
 	}